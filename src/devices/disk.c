@@ -3,13 +3,23 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  Transfers use
+   bus-master DMA, as in [IDE-BM], when the controller and disk
+   support it, and PIO otherwise.  Reads and writes are queued as
+   requests and issued in elevator order; see "Request dispatch"
+   below. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -32,6 +42,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,19 +58,70 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master port addresses, relative to the channel's bm_base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Direction: 1=disk to memory. */
+
+/* Bus master Status Register bits.  The last two clear when
+   written as 1. */
+#define BM_STA_ACTIVE 0x01      /* Transfer in progress. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_INTR 0x04        /* Disk interrupted. */
+
+/* A physical region descriptor: one piece of memory that a DMA
+   transfer reads or writes.  A channel's PRD table lists the
+   pieces of a transfer's buffer in order. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Size in bytes, even, 0 for 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* A PRD may not cross a 64 kB boundary. */
+#define PRD_BOUNDARY 0x10000
 
-/* An ATA device. */
+/* Most sectors transferred by one command: a sector count
+   register of 0 means 256.  Merged requests may fill it. */
+#define COMMAND_SECTORS_MAX 256
+
+/* An ATA device, or a disk that another driver registered with
+   disk_register(). */
 struct disk 
   {
     char name[8];               /* Name, e.g. "hd0:1". */
-    struct channel *channel;    /* Channel disk is on. */
+    struct channel *channel;    /* Channel disk is on, if ATA. */
+    disk_submit_func *submit;   /* Other driver's function, or null. */
+    void *aux;                  /* Passed to SUBMIT. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
 
     bool is_ata;                /* 1=This device is an ATA disk. */
     disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+    int multiple_cnt;           /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, or 0 if not in use. */
+    bool use_dma;               /* Transfer by bus-master DMA? */
+
+    /* Interrupts must be off to access these. */
+    struct list queue;          /* Waiting requests, by sector. */
+    disk_sector_t next_sector;  /* Sector after the last command. */
 
     long long read_cnt;         /* Number of sectors read. */
     long long write_cnt;        /* Number of sectors written. */
+    long long command_cnt;      /* Number of read and write commands. */
+    long long merge_cnt;        /* Requests merged into other commands. */
+    long long dma_cnt;          /* Number of sectors moved by DMA. */
   };
 
 /* An ATA channel (aka controller).
@@ -69,11 +131,26 @@ struct channel
     char name[8];               /* Name, e.g. "hd0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master base I/O port, or 0. */
+    struct prd *prdt;           /* PRD table, if bm_base is nonzero. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore completion_wait;   /* Up'd by interrupt handler
+                                           during detection. */
+    struct semaphore dispatch_wait;     /* Up'd when there may be a
+                                           command to issue. */
+
+    /* Command in progress.  Interrupts must be off to access
+       these outside the interrupt handler. */
+    struct list command;        /* Requests it serves, empty if idle. */
+    struct disk *command_disk;  /* Disk it is for, or was last. */
+    bool command_write;         /* Writing to disk? */
+    bool command_dma;           /* By DMA, or by PIO? */
+    size_t block_cnt;           /* PIO: Sectors per interrupt. */
+    size_t pio_left;            /* PIO: Sectors yet to move. */
+    struct list_elem *pio_req;  /* PIO: Request being moved. */
+    size_t pio_ofs;             /* PIO: Sectors of it moved. */
 
     struct disk devices[2];     /* The devices on this channel. */
   };
@@ -82,14 +159,36 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Disks registered by other drivers, by the role they fill; see
+   disk_get(). */
+static struct disk *registered[CHANNEL_CNT][2];
+
+/* Use DMA when possible?
+   Cleared by kernel command-line option "-pio". */
+bool disk_use_dma = true;
+
+static uint16_t find_bus_master (void);
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
+static void set_multiple_mode (struct disk *, int cnt);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
+
+static void transfer_sync (struct disk *, disk_sector_t, size_t cnt,
+                           void *, bool write);
+static list_less_func request_less;
+static thread_func dispatch_thread NO_RETURN;
+static struct disk *choose_disk (struct channel *);
+static size_t gather_command (struct disk *);
+static void start_command (struct disk *, size_t cnt);
+static void pio_transfer_block (struct channel *);
+static bool build_prdt (struct channel *);
+static void command_interrupt (struct channel *);
 
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
@@ -102,6 +201,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 disk_init (void) 
 {
+  uint16_t bm_base = disk_use_dma ? find_bus_master () : 0;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -124,9 +224,18 @@ disk_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->bm_base = bm_base + chan_no * 8;
+          c->prdt = palloc_get_page (PAL_ASSERT);
+        }
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      sema_init (&c->dispatch_wait, 0);
+      list_init (&c->command);
+      c->command_disk = &c->devices[1];
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -134,12 +243,18 @@ disk_init (void)
           struct disk *d = &c->devices[dev_no];
           snprintf (d->name, sizeof d->name, "%s:%d", c->name, dev_no);
           d->channel = c;
+          d->submit = NULL;
           d->dev_no = dev_no;
 
           d->is_ata = false;
           d->capacity = 0;
+          d->multiple_cnt = 0;
+          d->use_dma = false;
+          list_init (&d->queue);
+          d->next_sector = 0;
 
-          d->read_cnt = d->write_cnt = 0;
+          d->read_cnt = d->write_cnt = d->command_cnt = 0;
+          d->merge_cnt = d->dma_cnt = 0;
         }
 
       /* Register interrupt handler. */
@@ -156,6 +271,10 @@ disk_init (void)
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
+
+      /* Start issuing requests. */
+      if (c->devices[0].is_ata || c->devices[1].is_ata)
+        thread_create (c->name, PRI_MAX, dispatch_thread, c);
     }
 }
 
@@ -172,9 +291,11 @@ disk_print_stats (void)
       for (dev_no = 0; dev_no < 2; dev_no++) 
         {
           struct disk *d = disk_get (chan_no, dev_no);
-          if (d != NULL && d->is_ata) 
-            printf ("%s: %lld reads, %lld writes\n",
-                    d->name, d->read_cnt, d->write_cnt);
+          if (d != NULL) 
+            printf ("%s: %lld reads, %lld writes, %lld commands, "
+                    "%lld merged requests, %lld sectors by DMA\n",
+                    d->name, d->read_cnt, d->write_cnt, d->command_cnt,
+                    d->merge_cnt, d->dma_cnt);
         }
     }
 }
@@ -187,6 +308,9 @@ disk_print_stats (void)
         0:1 - file system
         1:0 - scratch
         1:1 - swap
+
+   A disk that another driver registered for one of these roles
+   takes the place of the ATA disk there.
 */
 struct disk *
 disk_get (int chan_no, int dev_no) 
@@ -196,12 +320,42 @@ disk_get (int chan_no, int dev_no)
   if (chan_no < (int) CHANNEL_CNT) 
     {
       struct disk *d = &channels[chan_no].devices[dev_no];
+      if (registered[chan_no][dev_no] != NULL)
+        return registered[chan_no][dev_no];
       if (d->is_ata)
         return d; 
     }
   return NULL;
 }
 
+/* Registers a disk named NAME, of CAPACITY sectors, that a
+   driver other than this one serves by starting each request
+   with SUBMIT, passing AUX along.  The driver must complete each
+   request as disk_submit() describes.  The disk fills the role
+   that disk_get() gives for CHAN_NO and DEV_NO, which must not
+   have been registered already.  Returns the new disk. */
+struct disk *
+disk_register (int chan_no, int dev_no, const char *name,
+               disk_sector_t capacity, disk_submit_func *submit, void *aux)
+{
+  struct disk *d;
+
+  ASSERT (chan_no >= 0 && chan_no < (int) CHANNEL_CNT);
+  ASSERT (dev_no == 0 || dev_no == 1);
+  ASSERT (registered[chan_no][dev_no] == NULL);
+  ASSERT (submit != NULL);
+
+  d = calloc (1, sizeof *d);
+  if (d == NULL)
+    PANIC ("%s: out of memory", name);
+  strlcpy (d->name, name, sizeof d->name);
+  d->capacity = capacity;
+  d->submit = submit;
+  d->aux = aux;
+  registered[chan_no][dev_no] = d;
+  return d;
+}
+
 /* Returns the size of disk D, measured in DISK_SECTOR_SIZE-byte
    sectors. */
 disk_sector_t
@@ -219,21 +373,7 @@ disk_size (struct disk *d)
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) 
 {
-  struct channel *c;
-  
-  ASSERT (d != NULL);
-  ASSERT (buffer != NULL);
-
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  d->read_cnt++;
-  lock_release (&c->lock);
+  disk_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -244,27 +384,457 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
-  struct channel *c;
-  
+  disk_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * DISK_SECTOR_SIZE bytes,
+   and waits for them to arrive.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                    void *buffer)
+{
+  transfer_sync (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes the CNT sectors starting at SEC_NO on disk D from
+   BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                     const void *buffer)
+{
+  transfer_sync (d, sec_no, cnt, (void *) buffer, true);
+}
+
+/* Queues request R for disk D and returns without waiting for
+   it.  When R completes, the disk interrupt handler calls
+   R->done, which therefore must not sleep.  Requests to ATA
+   disks are issued in elevator order, and those to other
+   drivers' disks may complete in any order, so requests whose
+   sectors overlap should not be outstanding at once. */
+void
+disk_submit (struct disk *d, struct disk_request *r)
+{
+  enum intr_level old_level;
+
+  ASSERT (d != NULL);
+  ASSERT (r->cnt >= 1 && r->cnt <= DISK_REQUEST_MAX);
+  ASSERT (r->sector < d->capacity && r->cnt <= d->capacity - r->sector);
+  ASSERT (r->buffer != NULL);
+  ASSERT (r->done != NULL);
+
+  old_level = intr_disable ();
+  if (d->submit != NULL)
+    {
+      if (r->write)
+        d->write_cnt += r->cnt;
+      else
+        d->read_cnt += r->cnt;
+      d->command_cnt++;
+      d->dma_cnt += r->cnt;
+      d->submit (d->aux, r);
+    }
+  else
+    {
+      list_insert_ordered (&d->queue, &r->elem, request_less, NULL);
+      sema_up (&d->channel->dispatch_wait);
+    }
+  intr_set_level (old_level);
+}
+
+/* Wakes the thread that waits for request R in
+   transfer_sync(). */
+static void
+wake_requester (struct disk_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Reads the CNT sectors starting at SEC_NO on disk D into
+   BUFFER, or writes them from BUFFER if WRITE is true, as one
+   request per DISK_REQUEST_MAX sectors, waiting for each. */
+static void
+transfer_sync (struct disk *d, disk_sector_t sec_no, size_t cnt,
+               void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+  struct semaphore done;
+
   ASSERT (d != NULL);
   ASSERT (buffer != NULL);
 
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  d->write_cnt++;
-  lock_release (&c->lock);
+  sema_init (&done, 0);
+  while (cnt > 0)
+    {
+      struct disk_request r;
+
+      r.sector = sec_no;
+      r.cnt = cnt < DISK_REQUEST_MAX ? cnt : DISK_REQUEST_MAX;
+      r.buffer = buffer;
+      r.write = write;
+      r.done = wake_requester;
+      r.aux = &done;
+      disk_submit (d, &r);
+      sema_down (&done);
+
+      buffer += r.cnt * DISK_SECTOR_SIZE;
+      sec_no += r.cnt;
+      cnt -= r.cnt;
+    }
 }
-
+
+/* Returns true if request A_ starts before request B_. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+  const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Request dispatch.
+
+   Each disk keeps its waiting requests in order of sector
+   number, and each channel has a thread that issues them one
+   command at a time, as the C-LOOK elevator would: it takes the
+   first request at or past the sector where the last command on
+   that disk ended, wrapping around to the lowest-numbered one
+   when there is none, so that the heads sweep across the disk in
+   one direction.  Requests that continue the chosen one, in the
+   same direction, join its command, up to COMMAND_SECTORS_MAX
+   sectors.
+
+   The interrupt handler moves the data of PIO commands block by
+   block, and calls the requests' completion functions when a
+   command ends, then wakes the dispatch thread to issue the
+   next. */
+
+/* Issues the requests queued for the disks on channel C_. */
+static void
+dispatch_thread (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct disk *d = NULL;
+      enum intr_level old_level;
+      size_t cnt;
+
+      old_level = intr_disable ();
+      while (!list_empty (&c->command) || (d = choose_disk (c)) == NULL)
+        sema_down (&c->dispatch_wait);
+      cnt = gather_command (d);
+      intr_set_level (old_level);
+
+      start_command (d, cnt);
+    }
+}
+
+/* Returns the disk on channel C whose requests to issue next,
+   alternating between the two when both have some waiting, or a
+   null pointer if neither has any.  Interrupts must be off. */
+static struct disk *
+choose_disk (struct channel *c)
+{
+  struct disk *other = (c->command_disk == &c->devices[0]
+                        ? &c->devices[1] : &c->devices[0]);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!list_empty (&other->queue))
+    return other;
+  else if (!list_empty (&c->command_disk->queue))
+    return c->command_disk;
+  else
+    return NULL;
+}
+
+/* Moves the requests for the next command from disk D's queue
+   to its channel's command list, as described above, and returns
+   the number of sectors they span.  Interrupts must be off. */
+static size_t
+gather_command (struct disk *d)
+{
+  struct channel *c = d->channel;
+  struct disk_request *first;
+  struct list_elem *e;
+  disk_sector_t end;
+  size_t cnt = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!list_empty (&d->queue));
+
+  for (e = list_begin (&d->queue); e != list_end (&d->queue);
+       e = list_next (e))
+    if (list_entry (e, struct disk_request, elem)->sector >= d->next_sector)
+      break;
+  if (e == list_end (&d->queue))
+    e = list_begin (&d->queue);
+
+  first = list_entry (e, struct disk_request, elem);
+  end = first->sector;
+  while (e != list_end (&d->queue))
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, elem);
+      if (r->sector < end)
+        {
+          /* Skip a request that starts inside the command. */
+          e = list_next (e);
+          continue;
+        }
+      if (r->sector > end || r->write != first->write
+          || cnt + r->cnt > COMMAND_SECTORS_MAX)
+        break;
+
+      e = list_remove (e);
+      list_push_back (&c->command, &r->elem);
+      if (r != first)
+        d->merge_cnt++;
+      end += r->cnt;
+      cnt += r->cnt;
+    }
+
+  c->command_disk = d;
+  c->command_write = first->write;
+  d->next_sector = end;
+  return cnt;
+}
+
+/* Returns the number of sectors that disk D transfers per
+   interrupt in a command that moves CNT sectors, and stores the
+   command to use into *COMMAND: READ or WRITE MULTIPLE, given as
+   MULTIPLE, if D has them enabled and CNT is more than 1, and
+   otherwise SINGLE, which interrupts once per sector. */
+static size_t
+sectors_per_interrupt (const struct disk *d, size_t cnt,
+                       uint8_t single, uint8_t multiple, uint8_t *command)
+{
+  if (d->multiple_cnt > 1 && cnt > 1)
+    {
+      *command = multiple;
+      return d->multiple_cnt;
+    }
+  *command = single;
+  return 1;
+}
+
+/* Issues the command gathered for disk D, which moves CNT
+   sectors, by DMA if possible and otherwise by PIO. */
+static void
+start_command (struct disk *d, size_t cnt)
+{
+  struct channel *c = d->channel;
+  struct disk_request *first = list_entry (list_front (&c->command),
+                                           struct disk_request, elem);
+  bool write = c->command_write;
+
+  if (write)
+    d->write_cnt += cnt;
+  else
+    d->read_cnt += cnt;
+  d->command_cnt++;
+
+  c->command_dma = d->use_dma && build_prdt (c);
+  if (c->command_dma)
+    {
+      uint8_t direction = write ? 0 : BM_READ;
+
+      /* Point the controller at the PRD table, set the direction,
+         and clear any status left from the last transfer.  Then
+         issue the command and start the transfer.  The disk
+         interrupts once, when all the data has moved. */
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_command (c), direction);
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+      select_sector (d, first->sector, cnt);
+      issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), direction | BM_START);
+      d->dma_cnt += cnt;
+    }
+  else
+    {
+      uint8_t command;
+
+      if (write)
+        c->block_cnt = sectors_per_interrupt (d, cnt, CMD_WRITE_SECTOR_RETRY,
+                                              CMD_WRITE_MULTIPLE, &command);
+      else
+        c->block_cnt = sectors_per_interrupt (d, cnt, CMD_READ_SECTOR_RETRY,
+                                              CMD_READ_MULTIPLE, &command);
+      c->pio_left = cnt;
+      c->pio_req = list_begin (&c->command);
+      c->pio_ofs = 0;
+      select_sector (d, first->sector, cnt);
+      issue_pio_command (c, command);
+
+      /* The disk interrupts when it has each block to read, or
+         when it is ready for each block to write after the first
+         and once more when it is done. */
+      if (write)
+        {
+          enum intr_level old_level;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, first->sector);
+          old_level = intr_disable ();
+          pio_transfer_block (c);
+          intr_set_level (old_level);
+        }
+    }
+}
+
+/* Moves the next block of channel C's PIO command between the
+   data register and its requests' buffers.  Interrupts must be
+   off. */
+static void
+pio_transfer_block (struct channel *c)
+{
+  size_t left = c->pio_left < c->block_cnt ? c->pio_left : c->block_cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  c->pio_left -= left;
+  while (left > 0)
+    {
+      struct disk_request *r = list_entry (c->pio_req,
+                                           struct disk_request, elem);
+      uint8_t *buffer = (uint8_t *) r->buffer + c->pio_ofs * DISK_SECTOR_SIZE;
+      size_t n = r->cnt - c->pio_ofs < left ? r->cnt - c->pio_ofs : left;
+
+      if (c->command_write)
+        output_sectors (c, buffer, n);
+      else
+        input_sectors (c, buffer, n);
+      c->pio_ofs += n;
+      if (c->pio_ofs == r->cnt)
+        {
+          c->pio_req = list_next (c->pio_req);
+          c->pio_ofs = 0;
+        }
+      left -= n;
+    }
+}
+
+/* Fills in channel C's PRD table to describe the buffers of the
+   requests in its command, in order.  Kernel virtual memory maps
+   physical memory in order, so each buffer is physically
+   contiguous and needs a new entry only at each 64 kB boundary.
+   That makes at most two entries per sector, so a page holds
+   enough for COMMAND_SECTORS_MAX sectors.  Returns false if a
+   buffer cannot be the target of DMA, because it is not in
+   kernel virtual memory or not at an even address. */
+static bool
+build_prdt (struct channel *c)
+{
+  struct prd *p = c->prdt;
+  struct list_elem *e;
+
+  for (e = list_begin (&c->command); e != list_end (&c->command);
+       e = list_next (e))
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, elem);
+      size_t size = r->cnt * DISK_SECTOR_SIZE;
+      uintptr_t addr;
+
+      if (!is_kernel_vaddr (r->buffer) || (uintptr_t) r->buffer % 2 != 0)
+        return false;
+
+      for (addr = vtop (r->buffer); size > 0; p++)
+        {
+          size_t n = PRD_BOUNDARY - addr % PRD_BOUNDARY;
+          if (n > size)
+            n = size;
+          p->addr = addr;
+          p->size = n == PRD_BOUNDARY ? 0 : n;
+          p->flags = 0;
+          addr += n;
+          size -= n;
+        }
+    }
+  ASSERT (p - c->prdt <= (ptrdiff_t) (PGSIZE / sizeof *p));
+  p[-1].flags = PRD_EOT;
+  return true;
+}
+
+/* Handles an interrupt for channel C's command in progress.
+   Moves the next block of data for PIO, and when the command is
+   done, completes its requests and wakes the dispatch thread. */
+static void
+command_interrupt (struct channel *c)
+{
+  struct disk *d = c->command_disk;
+  struct disk_request *first = list_entry (list_front (&c->command),
+                                           struct disk_request, elem);
+  uint8_t status = inb (reg_status (c));        /* Acknowledge interrupt. */
+  bool failed;
+
+  if (c->command_dma)
+    {
+      uint8_t bm_status = inb (reg_bm_status (c));
+
+      outb (reg_bm_command (c), c->command_write ? 0 : BM_READ);
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+      failed = (bm_status & BM_STA_ERR) != 0 || (status & STA_ERR) != 0;
+    }
+  else
+    {
+      bool more = c->pio_left > 0;
+
+      failed = ((status & (STA_BSY | STA_ERR)) != 0
+                || (more && (status & STA_DRQ) == 0));
+      if (!failed && more)
+        {
+          pio_transfer_block (c);
+          if (c->command_write || c->pio_left > 0)
+            return;
+        }
+    }
+  if (failed)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, c->command_write ? "write" : "read", first->sector);
+
+  while (!list_empty (&c->command))
+    {
+      struct disk_request *r = list_entry (list_pop_front (&c->command),
+                                           struct disk_request, elem);
+      r->done (r);
+    }
+  sema_up (&c->dispatch_wait);
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
 
+/* Looks for a PCI IDE controller that can act as a bus master
+   and enables it.  Returns the base I/O port of its bus master
+   registers, which serve the primary channel and, 8 ports
+   higher, the secondary one, or 0 if there is no such
+   controller. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_address a;
+  uint16_t base;
+
+  if (!pci_find_class (0x01, 0x01, 0, &a)
+      || (pci_read_config (a, PCI_CLASS) & 0x8000) == 0)
+    return 0;
+  base = pci_io_base (a, 4);
+  if (base != 0)
+    pci_enable (a, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+  return base;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -381,11 +951,18 @@ identify_ata_device (struct disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity. */
   d->capacity = id[60] | ((uint32_t) id[61] << 16);
 
+  /* Use READ/WRITE MULTIPLE with the largest block the disk
+     supports. */
+  set_multiple_mode (d, id[47] & 0xff);
+
+  /* Use DMA if both the disk and its controller support it. */
+  d->use_dma = c->bm_base != 0 && (id[49] & 0x100) != 0;
+
   /* Print identification message. */
   printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
   if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
@@ -401,7 +978,34 @@ identify_ata_device (struct disk *d)
   print_ata_string ((char *) &id[27], 40);
   printf ("\", serial \"");
   print_ata_string ((char *) &id[10], 20);
-  printf ("\"\n");
+  printf ("\"");
+  if (d->multiple_cnt > 1)
+    printf (", %d sectors per interrupt", d->multiple_cnt);
+  if (d->use_dma)
+    printf (", DMA");
+  printf ("\n");
+}
+
+/* Asks disk D to transfer CNT sectors per interrupt in READ
+   MULTIPLE and WRITE MULTIPLE commands, and sets D's multiple_cnt
+   member to CNT if it agrees, or to 0 otherwise.  A CNT of 0
+   means that D has no such commands. */
+static void
+set_multiple_mode (struct disk *d, int cnt)
+{
+  struct channel *c = d->channel;
+
+  d->multiple_cnt = 0;
+  if (cnt < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple_cnt = cnt;
 }
 
 /* Prints STRING, which consists of SIZE bytes in a funky format:
@@ -426,18 +1030,19 @@ print_ata_string (char *string, size_t size)
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) 
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) 
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < d->capacity);
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= COMMAND_SECTORS_MAX);
+  ASSERT (sec_no < d->capacity && cnt <= d->capacity - sec_no);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == COMMAND_SECTORS_MAX ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -458,20 +1063,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * DISK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain DISK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode.  SECTORS must contain CNT * DISK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * DISK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -555,7 +1162,9 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (!list_empty (&c->command))
+          command_interrupt (c);
+        else if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
@@ -2,6 +2,9 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
@@ -15,12 +18,43 @@ typedef uint32_t disk_sector_t;
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Use DMA when possible?
+   Cleared by kernel command-line option "-pio". */
+extern bool disk_use_dma;
+
+/* Most sectors in one request. */
+#define DISK_REQUEST_MAX 256
+
+/* A request to read or write a run of sectors, for
+   disk_submit(). */
+struct disk_request
+  {
+    disk_sector_t sector;       /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * DISK_SECTOR_SIZE bytes. */
+    bool write;                 /* Write BUFFER to disk, or read it? */
+    void (*done) (struct disk_request *); /* Called on completion. */
+    void *aux;                  /* For use by DONE. */
+    struct list_elem elem;      /* Used by the disk driver. */
+  };
+
+/* Starts request R on a disk that another driver serves.  AUX is
+   the value the driver gave disk_register(). */
+typedef void disk_submit_func (void *aux, struct disk_request *r);
+
 void disk_init (void);
 void disk_print_stats (void);
 
 struct disk *disk_get (int chan_no, int dev_no);
+struct disk *disk_register (int chan_no, int dev_no, const char *name,
+                            disk_sector_t capacity, disk_submit_func *,
+                            void *aux);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+                          const void *);
+void disk_submit (struct disk *, struct disk_request *);
 
 #endif /* devices/disk.h */
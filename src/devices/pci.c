@@ -0,0 +1,129 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space by way of configuration
+   mechanism #1, which every PC chipset that Pintos runs on
+   supports.  Refer to [PCI] for details. */
+
+#define CONFIG_ADDRESS 0xcf8    /* Selects a configuration word. */
+#define CONFIG_DATA 0xcfc       /* Reads or writes it. */
+
+#define BUS_CNT 256             /* Buses. */
+#define DEV_CNT 32              /* Devices per bus. */
+#define FUNC_CNT 8              /* Functions per device. */
+
+/* Selects configuration word REG of function A. */
+static void
+select_config (struct pci_address a, int reg)
+{
+  ASSERT (reg % 4 == 0 && reg < 256);
+  outl (CONFIG_ADDRESS, (0x80000000u | ((uint32_t) a.bus << 16)
+                         | ((uint32_t) a.dev << 11)
+                         | ((uint32_t) a.func << 8) | reg));
+}
+
+/* Returns configuration word REG of function A. */
+uint32_t
+pci_read_config (struct pci_address a, int reg)
+{
+  select_config (a, reg);
+  return inl (CONFIG_DATA);
+}
+
+/* Sets configuration word REG of function A to VALUE. */
+void
+pci_write_config (struct pci_address a, int reg, uint32_t value)
+{
+  select_config (a, reg);
+  outl (CONFIG_DATA, value);
+}
+
+/* Finds the IDX'th function, counting from 0, whose
+   configuration word REG, masked with MASK, equals VALUE, and
+   stores its address into *A.  Returns true if successful, false
+   if there are not that many such functions. */
+static bool
+find_function (int reg, uint32_t mask, uint32_t value, int idx,
+               struct pci_address *a)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < BUS_CNT; bus++)
+    for (dev = 0; dev < DEV_CNT; dev++)
+      for (func = 0; func < FUNC_CNT; func++)
+        {
+          struct pci_address cur = {bus, dev, func};
+
+          if ((pci_read_config (cur, PCI_ID) & 0xffff) == 0xffff)
+            {
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if ((pci_read_config (cur, reg) & mask) == value && idx-- == 0)
+            {
+              *a = cur;
+              return true;
+            }
+
+          /* Only multi-function devices have functions past 0. */
+          if (func == 0
+              && (pci_read_config (cur, PCI_HEADER) & 0x800000) == 0)
+            break;
+        }
+  return false;
+}
+
+/* Finds the IDX'th function, counting from 0, whose class and
+   subclass are CLASS and SUBCLASS, and stores its address into
+   *A.  Returns true if successful, false if there are not that
+   many such functions. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, int idx,
+                struct pci_address *a)
+{
+  return find_function (PCI_CLASS, 0xffff0000,
+                        ((uint32_t) class << 24) | ((uint32_t) subclass << 16),
+                        idx, a);
+}
+
+/* Finds the IDX'th function, counting from 0, with vendor ID
+   VENDOR and device ID DEVICE, and stores its address into *A.
+   Returns true if successful, false if there are not that many
+   such functions. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int idx,
+                 struct pci_address *a)
+{
+  return find_function (PCI_ID, 0xffffffff,
+                        ((uint32_t) device << 16) | vendor, idx, a);
+}
+
+/* Returns the I/O port base address in base address register BAR
+   of function A, or 0 if that register maps memory or nothing. */
+uint16_t
+pci_io_base (struct pci_address a, int bar)
+{
+  uint32_t value = pci_read_config (a, PCI_BAR0 + bar * 4);
+  return (value & 1) != 0 ? value & 0xfffc : 0;
+}
+
+/* Returns the interrupt line that the firmware routed function
+   A's interrupt pin to, or 0xff if none. */
+uint8_t
+pci_interrupt_line (struct pci_address a)
+{
+  return pci_read_config (a, PCI_INTERRUPT) & 0xff;
+}
+
+/* Sets COMMAND_BITS in function A's command register. */
+void
+pci_enable (struct pci_address a, uint16_t command_bits)
+{
+  uint32_t value = pci_read_config (a, PCI_COMMAND);
+
+  /* Leave the status bits, which clear when written as 1, be. */
+  pci_write_config (a, PCI_COMMAND, (value & 0xffff) | command_bits);
+}
@@ -0,0 +1,40 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function. */
+struct pci_address
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number within bus. */
+    uint8_t func;               /* Function number within device. */
+  };
+
+/* Configuration space registers, as offsets of the 32-bit words
+   that hold them. */
+#define PCI_ID 0x00             /* Device ID 31:16, vendor ID 15:0. */
+#define PCI_COMMAND 0x04        /* Status 31:16, command 15:0. */
+#define PCI_CLASS 0x08          /* Class 31:24, subclass 23:16,
+                                   programming interface 15:8. */
+#define PCI_HEADER 0x0c         /* Header type 23:16. */
+#define PCI_BAR0 0x10           /* Base address registers 0...5. */
+#define PCI_INTERRUPT 0x3c      /* Interrupt line 7:0. */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x0001           /* Respond to I/O space. */
+#define PCI_COMMAND_MEMORY 0x0002       /* Respond to memory space. */
+#define PCI_COMMAND_MASTER 0x0004       /* Allow bus mastering. */
+
+uint32_t pci_read_config (struct pci_address, int reg);
+void pci_write_config (struct pci_address, int reg, uint32_t);
+bool pci_find_class (uint8_t class, uint8_t subclass, int idx,
+                     struct pci_address *);
+bool pci_find_device (uint16_t vendor, uint16_t device, int idx,
+                      struct pci_address *);
+uint16_t pci_io_base (struct pci_address, int bar);
+uint8_t pci_interrupt_line (struct pci_address);
+void pci_enable (struct pci_address, uint16_t command_bits);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,463 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices, such as QEMU emulates, by way
+   of the legacy PCI interface in [VIRTIO].
+
+   Each device has one "split" virtqueue, which consists of a
+   table of buffer descriptors, a ring in which the driver makes
+   chains of descriptors available to the device, and a ring in
+   which the device returns the chains it has used.  A request
+   takes a chain of three descriptors, for its header, its data,
+   and its status byte, so that a queue of N descriptors keeps up
+   to N / 3 requests outstanding at once.  Further requests wait
+   in a list until a chain comes free.
+
+   Each device registers itself with disk_register() for the role
+   that its ID string names, e.g. "hd0:1" for the file system
+   disk, which "pintos --virtio" sets. */
+
+/* PCI vendor ID of virtio devices, and the device ID of a block
+   device with the legacy interface. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio registers, relative to the I/O base in BAR 0. */
+#define REG_HOST_FEATURES 0x00  /* Device features (32 bits). */
+#define REG_GUEST_FEATURES 0x04 /* Driver features (32 bits). */
+#define REG_QUEUE_PFN 0x08      /* Queue page number (32 bits). */
+#define REG_QUEUE_SIZE 0x0c     /* Queue size (16 bits, r/o). */
+#define REG_QUEUE_SELECT 0x0e   /* Queue select (16 bits). */
+#define REG_QUEUE_NOTIFY 0x10   /* Queue notify (16 bits). */
+#define REG_STATUS 0x12         /* Device status (8 bits). */
+#define REG_ISR 0x13            /* ISR status (8 bits, read clears). */
+#define REG_CAPACITY 0x14       /* Capacity in sectors (64 bits). */
+
+/* Device Status Register bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Driver found the device. */
+#define STATUS_DRIVER 0x02      /* Driver can drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up on it. */
+
+/* A buffer descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* DESC_* bits. */
+    uint16_t next;              /* Next descriptor, if DESC_NEXT. */
+  };
+#define DESC_NEXT 1             /* Chain continues at `next'. */
+#define DESC_WRITE 2            /* Device writes, not reads, buffer. */
+
+/* Ring of chains available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;             /* Unused. */
+    uint16_t idx;               /* Incremented per chain added. */
+    uint16_t ring[];            /* First descriptor of each chain. */
+  };
+
+/* A chain that the device has used. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* First descriptor of chain. */
+    uint32_t len;               /* Bytes written into it. */
+  };
+
+/* Ring of chains the device has used. */
+struct vring_used
+  {
+    uint16_t flags;             /* Unused. */
+    uint16_t idx;               /* Incremented per chain returned. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header, the first buffer in a chain. */
+struct request_header
+  {
+    uint32_t type;              /* TYPE_* value. */
+    uint32_t reserved;          /* Must be 0. */
+    uint64_t sector;            /* First sector to transfer. */
+  };
+#define TYPE_IN 0               /* Read. */
+#define TYPE_OUT 1              /* Write. */
+#define TYPE_GET_ID 8           /* Read ID string. */
+
+/* Request status, the last buffer in a chain. */
+#define STATUS_OK 0             /* Success. */
+
+/* Length of the ID string that TYPE_GET_ID reads. */
+#define ID_LEN 20
+
+/* A chain of three descriptors, with the header and status that
+   the first and last point to. */
+struct chain
+  {
+    struct request_header header;
+    uint8_t status;
+    struct disk_request *request;       /* Request using it, or null. */
+  };
+
+/* A virtio block device. */
+struct vblk
+  {
+    char name[8];               /* Name, e.g. "vd0:1". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt in use. */
+    struct list_elem elem;      /* Element in `devices'. */
+
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+
+    /* Interrupts must be off to access these. */
+    uint16_t used_idx;          /* Next used ring entry to process. */
+    struct chain *chains;       /* Chains, in a page of their own. */
+    size_t chain_cnt;           /* Number of chains. */
+    struct list waiting;        /* Requests waiting for a chain. */
+  };
+
+/* All the virtio block devices. */
+static struct list devices;
+
+static struct vblk *init_device (struct pci_address);
+static void read_id (struct vblk *, char id[ID_LEN + 1]);
+static bool choose_role (const char *id, int *chan_no, int *dev_no);
+static void start_request (struct vblk *, struct chain *,
+                           struct disk_request *, uint32_t type,
+                           size_t size);
+static disk_submit_func submit_request;
+static void wake_requester (struct disk_request *);
+static void complete_requests (struct vblk *);
+static intr_handler_func interrupt_handler;
+
+/* Finds and initializes virtio block devices and registers each
+   one as a disk.  Must be called after disk_init(). */
+void
+virtio_blk_init (void)
+{
+  struct pci_address a;
+  int idx;
+
+  list_init (&devices);
+  for (idx = 0; pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, idx, &a);
+       idx++)
+    {
+      struct vblk *vb = init_device (a);
+      char id[ID_LEN + 1];
+      disk_sector_t capacity;
+      int chan_no, dev_no;
+
+      if (vb == NULL)
+        continue;
+
+      /* Read capacity, which does not fit a disk_sector_t on
+         disks over 2 TB. */
+      capacity = inl (vb->io_base + REG_CAPACITY);
+      if (inl (vb->io_base + REG_CAPACITY + 4) != 0)
+        capacity = (disk_sector_t) -1;
+
+      read_id (vb, id);
+      if (!choose_role (id, &chan_no, &dev_no))
+        {
+          printf ("virtio-blk: no free disk role for device \"%s\"\n", id);
+          continue;
+        }
+      snprintf (vb->name, sizeof vb->name, "vd%d:%d", chan_no, dev_no);
+      disk_register (chan_no, dev_no, vb->name, capacity,
+                     submit_request, vb);
+      printf ("%s: detected %'"PRDSNu" sector virtio disk, "
+              "%zu requests at once\n", vb->name, capacity, vb->chain_cnt);
+    }
+}
+
+/* Resets the virtio block device at A, sets up its virtqueue,
+   and tells it that the driver is ready.  Returns the new device,
+   or a null pointer on failure. */
+static struct vblk *
+init_device (struct pci_address a)
+{
+  uint16_t io_base = pci_io_base (a, 0);
+  uint8_t line = pci_interrupt_line (a);
+  size_t avail_end, ring_pages;
+  struct vblk *vb;
+  struct list_elem *e;
+  uint8_t *ring;
+  bool irq_shared;
+  size_t i;
+
+  if (io_base == 0 || line >= 16)
+    {
+      printf ("virtio-blk: device %02x:%02x.%x has no I/O ports "
+              "or interrupt\n", a.bus, a.dev, a.func);
+      return NULL;
+    }
+  pci_enable (a, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  /* Reset the device, then acknowledge it.  We need no optional
+     features. */
+  outb (io_base + REG_STATUS, 0);
+  outb (io_base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (io_base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (io_base + REG_HOST_FEATURES);
+  outl (io_base + REG_GUEST_FEATURES, 0);
+
+  /* Allocate the virtqueue: the descriptor table, followed by
+     the available ring, followed on the next page by the used
+     ring. */
+  outw (io_base + REG_QUEUE_SELECT, 0);
+  vb = malloc (sizeof *vb);
+  if (vb == NULL)
+    goto fail;
+  vb->queue_size = inw (io_base + REG_QUEUE_SIZE);
+  avail_end = (sizeof (struct vring_desc) * vb->queue_size
+               + sizeof (struct vring_avail)
+               + sizeof (uint16_t) * (vb->queue_size + 1));
+  ring_pages = (DIV_ROUND_UP (avail_end, PGSIZE)
+                + DIV_ROUND_UP (sizeof (struct vring_used)
+                                + (sizeof (struct vring_used_elem)
+                                   * vb->queue_size)
+                                + sizeof (uint16_t), PGSIZE));
+  ring = vb->queue_size >= 3 ? palloc_get_multiple (PAL_ZERO, ring_pages)
+                             : NULL;
+  vb->chains = palloc_get_page (PAL_ZERO);
+  if (ring == NULL || vb->chains == NULL)
+    {
+      if (ring != NULL)
+        palloc_free_multiple (ring, ring_pages);
+      palloc_free_page (vb->chains);
+      free (vb);
+      goto fail;
+    }
+  vb->desc = (struct vring_desc *) ring;
+  vb->avail = (struct vring_avail *) (ring + sizeof (struct vring_desc)
+                                             * vb->queue_size);
+  vb->used = (struct vring_used *) (ring + ROUND_UP (avail_end, PGSIZE));
+  vb->used_idx = 0;
+
+  /* Link each chain's descriptors. */
+  vb->chain_cnt = vb->queue_size / 3;
+  if (vb->chain_cnt > PGSIZE / sizeof *vb->chains)
+    vb->chain_cnt = PGSIZE / sizeof *vb->chains;
+  for (i = 0; i < vb->chain_cnt; i++)
+    {
+      struct vring_desc *d = &vb->desc[i * 3];
+
+      d[0].addr = vtop (&vb->chains[i].header);
+      d[0].len = sizeof vb->chains[i].header;
+      d[0].flags = DESC_NEXT;
+      d[0].next = i * 3 + 1;
+      d[1].next = i * 3 + 2;
+      d[2].addr = vtop (&vb->chains[i].status);
+      d[2].len = sizeof vb->chains[i].status;
+      d[2].flags = DESC_WRITE;
+    }
+  list_init (&vb->waiting);
+  outl (io_base + REG_QUEUE_PFN, vtop (ring) / PGSIZE);
+
+  /* Register the interrupt handler, unless another device that
+     shares the interrupt already did. */
+  vb->io_base = io_base;
+  vb->irq = line + 0x20;
+  irq_shared = false;
+  for (e = list_begin (&devices); e != list_end (&devices); e = list_next (e))
+    if (list_entry (e, struct vblk, elem)->irq == vb->irq)
+      irq_shared = true;
+  if (!irq_shared)
+    intr_register_ext (vb->irq, interrupt_handler, "virtio-blk");
+  list_push_back (&devices, &vb->elem);
+
+  outb (io_base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return vb;
+
+ fail:
+  printf ("virtio-blk: device %02x:%02x.%x: can't set up virtqueue\n",
+          a.bus, a.dev, a.func);
+  outb (io_base + REG_STATUS, STATUS_FAILED);
+  return NULL;
+}
+
+/* Reads device VB's ID string into ID and null-terminates it.
+   Reads an empty string if the device has none. */
+static void
+read_id (struct vblk *vb, char id[ID_LEN + 1])
+{
+  struct disk_request r;
+  struct semaphore done;
+  enum intr_level old_level;
+
+  memset (id, 0, ID_LEN + 1);
+  sema_init (&done, 0);
+  r.sector = 0;
+  r.cnt = 0;
+  r.buffer = id;
+  r.write = false;
+  r.done = wake_requester;
+  r.aux = &done;
+
+  old_level = intr_disable ();
+  start_request (vb, &vb->chains[0], &r, TYPE_GET_ID, ID_LEN);
+  intr_set_level (old_level);
+  sema_down (&done);
+}
+
+/* Chooses the role, in the sense of disk_get(), for a device
+   whose ID string is ID, and stores it into *CHAN_NO and
+   *DEV_NO.  That is the role ID names, in the form "hd1:0", or
+   otherwise the first of the file system, scratch and swap roles
+   that no disk fills yet.  Returns false if there is none. */
+static bool
+choose_role (const char *id, int *chan_no, int *dev_no)
+{
+  static bool taken[2][2];
+
+  if (id[0] == 'h' && id[1] == 'd' && (id[2] == '0' || id[2] == '1')
+      && id[3] == ':' && (id[4] == '0' || id[4] == '1') && id[5] == '\0'
+      && !taken[id[2] - '0'][id[4] - '0'])
+    {
+      *chan_no = id[2] - '0';
+      *dev_no = id[4] - '0';
+    }
+  else if (disk_get (0, 1) == NULL)
+    *chan_no = 0, *dev_no = 1;
+  else if (disk_get (1, 0) == NULL)
+    *chan_no = 1, *dev_no = 0;
+  else if (disk_get (1, 1) == NULL)
+    *chan_no = 1, *dev_no = 1;
+  else
+    return false;
+  taken[*chan_no][*dev_no] = true;
+  return true;
+}
+
+/* Starts request R on device VB in CHAIN, which must be free: a
+   request of type TYPE that moves SIZE bytes between R's buffer
+   and the disk.  Interrupts must be off. */
+static void
+start_request (struct vblk *vb, struct chain *chain,
+               struct disk_request *r, uint32_t type, size_t size)
+{
+  size_t idx = chain - vb->chains;
+  struct vring_desc *d = &vb->desc[idx * 3];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (chain->request == NULL);
+  ASSERT (is_kernel_vaddr (r->buffer));
+
+  chain->request = r;
+  chain->header.type = type;
+  chain->header.reserved = 0;
+  chain->header.sector = r->sector;
+  chain->status = 0xff;
+
+  /* Kernel virtual memory maps physical memory in order, so the
+     buffer is physically contiguous. */
+  d[1].addr = vtop (r->buffer);
+  d[1].len = size;
+  d[1].flags = DESC_NEXT | (type == TYPE_OUT ? 0 : DESC_WRITE);
+
+  /* Make the chain available, then tell the device. */
+  vb->avail->ring[vb->avail->idx % vb->queue_size] = idx * 3;
+  barrier ();
+  vb->avail->idx++;
+  barrier ();
+  outw (vb->io_base + REG_QUEUE_NOTIFY, 0);
+}
+
+/* Starts request R on device VB_, or queues it until a chain
+   comes free. */
+static void
+submit_request (void *vb_, struct disk_request *r)
+{
+  struct vblk *vb = vb_;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < vb->chain_cnt; i++)
+    if (vb->chains[i].request == NULL)
+      break;
+  if (i < vb->chain_cnt)
+    start_request (vb, &vb->chains[i], r,
+                   r->write ? TYPE_OUT : TYPE_IN, r->cnt * DISK_SECTOR_SIZE);
+  else
+    list_push_back (&vb->waiting, &r->elem);
+  intr_set_level (old_level);
+}
+
+/* Wakes the thread that waits for request R in read_id(). */
+static void
+wake_requester (struct disk_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Completes the requests whose chains device VB has returned,
+   starting waiting requests in the chains that they free. */
+static void
+complete_requests (struct vblk *vb)
+{
+  for (;;)
+    {
+      struct vring_used_elem *u;
+      struct chain *chain;
+      struct disk_request *r;
+
+      barrier ();
+      if (vb->used_idx == vb->used->idx)
+        break;
+      u = &vb->used->ring[vb->used_idx++ % vb->queue_size];
+      chain = &vb->chains[u->id / 3];
+      r = chain->request;
+      if (chain->status != STATUS_OK)
+        {
+          if (chain->header.type != TYPE_GET_ID)
+            PANIC ("%s: disk %s failed, sector=%"PRDSNu, vb->name,
+                   r->write ? "write" : "read", r->sector);
+          memset (r->buffer, 0, ID_LEN);
+        }
+
+      chain->request = NULL;
+      if (!list_empty (&vb->waiting))
+        {
+          struct disk_request *next
+            = list_entry (list_pop_front (&vb->waiting),
+                          struct disk_request, elem);
+          start_request (vb, chain, next, next->write ? TYPE_OUT : TYPE_IN,
+                         next->cnt * DISK_SECTOR_SIZE);
+        }
+      r->done (r);
+    }
+}
+
+/* virtio-blk interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&devices); e != list_end (&devices); e = list_next (e))
+    {
+      struct vblk *vb = list_entry (e, struct vblk, elem);
+      if (vb->irq == f->vec_no)
+        {
+          inb (vb->io_base + REG_ISR);          /* Acknowledge interrupt. */
+          complete_requests (vb);
+        }
+    }
+}
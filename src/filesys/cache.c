@@ -0,0 +1,839 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Sector buffer cache.
+
+   Every file system sector is read and written through one of
+   CACHE_CNT cache blocks.  A block is locked for reading
+   (NON_EXCLUSIVE) or writing (EXCLUSIVE) before its data is
+   touched; writes only mark the block dirty, and dirty blocks
+   reach the disk when they are evicted, when the flusher writes
+   them behind, or at cache_flush().
+   Blocks are evicted in clock order, skipping any that were
+   accessed since the hand last passed them.
+
+   A background thread reads sectors queued by cache_readahead()
+   into the cache, so that sequential readers find them there.
+   Runs of consecutive sectors are read and written back with one
+   disk request each, by way of a buffer of RUN_MAX sectors.
+
+   Another background thread, the flusher, writes dirty blocks
+   back every cache_flush_interval ticks, or sooner once
+   FLUSH_DIRTY_CNT blocks are dirty.  Writers that find
+   THROTTLE_DIRTY_CNT blocks dirty wait in cache_throttle() until
+   the flusher catches up.  The flusher sleeps until one of these
+   wakes it; a third thread wakes it when the interval is up.
+
+   A block pinned by the journal is part of a transaction that
+   has not yet been logged.  It is neither written back nor
+   evicted until the journal unpins it. */
+
+#define INVALID_SECTOR ((disk_sector_t) -1)
+
+/* A cached block. */
+struct cache_block
+  {
+    /* Locking to prevent eviction. */
+    struct lock block_lock;                 /* Protects fields in group. */
+    struct condition no_readers_or_writers; /* readers == 0 && writers == 0 */
+    struct condition no_writers;            /* writers == 0 */
+    int readers, read_waiters;              /* # of readers, # waiting. */
+    int writers, write_waiters;             /* # of writers (<= 1), # waiting. */
+    disk_sector_t sector;                   /* Sector, or INVALID_SECTOR. */
+    bool accessed;                          /* Used since clock hand passed? */
+    bool pinned;                            /* Held back by the journal? */
+
+    /* Protects members below. */
+    struct lock data_lock;
+    bool up_to_date;                        /* Data matches disk? */
+    bool dirty;                             /* Data differs from disk? */
+    uint8_t data[DISK_SECTOR_SIZE];         /* Disk data. */
+  };
+
+/* Cache. */
+#define CACHE_CNT 64
+static struct cache_block cache[CACHE_CNT];
+
+/* Serializes finding a block, so that a sector is never cached
+   twice, and protects the clock hand. */
+static struct lock cache_sync;
+static int hand = 0;
+
+/* Buffer for a run of sectors read or written at once, and the
+   lock that serializes its users.  A thread that holds RUN_LOCK
+   may lock blocks only in ways that do not wait. */
+#define RUN_MAX 16
+static uint8_t run_buffer[RUN_MAX][DISK_SECTOR_SIZE];
+static struct lock run_lock;
+
+/* A sector queued for read-ahead. */
+struct readahead_s
+  {
+    struct list_elem list_elem;         /* Element in readahead_list. */
+    disk_sector_t sector;               /* Sector to read. */
+  };
+
+/* Protects readahead_list and readahead_queued. */
+static struct lock readahead_lock;
+
+/* Signaled when a sector is added to readahead_list. */
+static struct condition need_readahead;
+
+/* Sectors queued for read-ahead, and how many.  Requests beyond
+   READAHEAD_QUEUE_MAX are dropped: a reader that gets that far
+   ahead of the disk gains nothing from more. */
+static struct list readahead_list;
+static size_t readahead_queued;
+#define READAHEAD_QUEUE_MAX CACHE_CNT
+
+/* Ticks between periodic flushes.
+   Controlled by kernel command-line option "-wb". */
+int64_t cache_flush_interval = CACHE_FLUSH_INTERVAL_DEFAULT;
+
+/* The flusher writes back early above FLUSH_DIRTY_CNT dirty
+   blocks; writers wait above THROTTLE_DIRTY_CNT. */
+#define FLUSH_DIRTY_CNT (CACHE_CNT / 2)
+#define THROTTLE_DIRTY_CNT (CACHE_CNT * 3 / 4)
+
+/* Protects dirty_cnt, flush_wanted and writeback_cnt. */
+static struct lock dirty_lock;
+
+/* Signaled when dirty_cnt drops below THROTTLE_DIRTY_CNT. */
+static struct condition dirty_drained;
+
+/* Set, and need_flush signaled, to wake the flusher. */
+static bool flush_wanted;
+static struct condition need_flush;
+
+/* Number of dirty blocks. */
+static int dirty_cnt;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, writeback_cnt, readahead_cnt;
+static long long throttle_cnt;
+
+static struct cache_block *lock_sector (disk_sector_t, enum lock_type,
+                                        bool only_new);
+static thread_func readahead_daemon;
+static thread_func flush_daemon;
+static thread_func flush_timer;
+
+/* Initializes the cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  ASSERT (CACHE_PIN_MAX <= CACHE_CNT / 2);
+  ASSERT (CACHE_PIN_MAX < THROTTLE_DIRTY_CNT);
+
+  lock_init (&cache_sync);
+  lock_init (&run_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      lock_init (&b->block_lock);
+      cond_init (&b->no_readers_or_writers);
+      cond_init (&b->no_writers);
+      b->readers = b->read_waiters = 0;
+      b->writers = b->write_waiters = 0;
+      b->sector = INVALID_SECTOR;
+      b->accessed = false;
+      b->pinned = false;
+      lock_init (&b->data_lock);
+    }
+
+  lock_init (&readahead_lock);
+  cond_init (&need_readahead);
+  list_init (&readahead_list);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+
+  lock_init (&dirty_lock);
+  cond_init (&dirty_drained);
+  cond_init (&need_flush);
+  thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("flush-timer", PRI_DEFAULT, flush_timer, NULL);
+}
+
+/* Wakes the flusher.
+   The caller must hold dirty_lock. */
+static void
+wake_flusher (void)
+{
+  flush_wanted = true;
+  cond_signal (&need_flush, &dirty_lock);
+}
+
+/* Sets B's dirty bit to DIRTY, keeping dirty_cnt up to date.
+   To set the bit, the caller must have a lock on B.  To clear
+   it, the caller must keep writers from changing B's data since
+   that data was written back, by holding B's data_lock or any
+   lock on B that excludes writers. */
+static void
+set_dirty (struct cache_block *b, bool dirty)
+{
+  lock_acquire (&dirty_lock);
+  if (dirty != b->dirty)
+    {
+      b->dirty = dirty;
+      dirty_cnt += dirty ? 1 : -1;
+      if (dirty && dirty_cnt >= FLUSH_DIRTY_CNT)
+        wake_flusher ();
+      else if (!dirty && dirty_cnt < THROTTLE_DIRTY_CNT)
+        cond_broadcast (&dirty_drained, &dirty_lock);
+    }
+  lock_release (&dirty_lock);
+}
+
+/* Writes B to disk if it is dirty.
+   B's data_lock must be held. */
+static void
+write_back (struct cache_block *b)
+{
+  if (b->up_to_date && b->dirty)
+    {
+      disk_write (filesys_disk, b->sector, b->data);
+      set_dirty (b, false);
+      lock_acquire (&dirty_lock);
+      writeback_cnt++;
+      lock_release (&dirty_lock);
+    }
+}
+
+/* Returns the block that caches SECTOR, locked NON_EXCLUSIVE, if
+   it is dirty and not pinned and can be locked without waiting,
+   or a null pointer otherwise. */
+static struct cache_block *
+try_lock_dirty (disk_sector_t sector)
+{
+  int i;
+
+  lock_acquire (&cache_sync);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      bool ok;
+
+      lock_acquire (&b->block_lock);
+      if (b->sector != sector)
+        {
+          lock_release (&b->block_lock);
+          continue;
+        }
+      ok = (b->up_to_date && b->dirty && !b->pinned
+            && b->writers == 0 && b->write_waiters == 0);
+      if (ok)
+        b->readers++;
+      lock_release (&b->block_lock);
+      lock_release (&cache_sync);
+      return ok ? b : NULL;
+    }
+  lock_release (&cache_sync);
+  return NULL;
+}
+
+/* Writes back, with one disk request, the dirty blocks that cache
+   the run of consecutive sectors at the start of the CNT sectors
+   in SECTORS, which must be ascending.  The run ends at RUN_MAX
+   sectors, or at the first sector that does not follow the one
+   before it or whose block try_lock_dirty() cannot lock.
+   Returns the number of sectors written back, which is 0 if the
+   first one's block could not be locked. */
+static size_t
+write_run (const disk_sector_t sectors[], size_t cnt)
+{
+  struct cache_block *run[RUN_MAX];
+  size_t n, i;
+
+  lock_acquire (&run_lock);
+  for (n = 0; n < cnt && n < RUN_MAX; n++)
+    {
+      if (n > 0 && sectors[n] != sectors[0] + n)
+        break;
+      run[n] = try_lock_dirty (sectors[n]);
+      if (run[n] == NULL)
+        break;
+      lock_acquire (&run[n]->data_lock);
+      memcpy (run_buffer[n], run[n]->data, DISK_SECTOR_SIZE);
+      lock_release (&run[n]->data_lock);
+    }
+  if (n > 0)
+    disk_write_multiple (filesys_disk, sectors[0], n, run_buffer);
+  lock_release (&run_lock);
+
+  for (i = 0; i < n; i++)
+    {
+      set_dirty (run[i], false);
+      cache_unlock (run[i]);
+    }
+  lock_acquire (&dirty_lock);
+  writeback_cnt += n;
+  lock_release (&dirty_lock);
+  return n;
+}
+
+/* Flushes cache to disk.  Dirty blocks are written in order of
+   sector number, so that the disk sweeps across them once, and
+   runs of adjacent sectors are written with one request. */
+void
+cache_flush (void)
+{
+  disk_sector_t sectors[CACHE_CNT];
+  size_t cnt = 0;
+  size_t i, n;
+
+  /* Collect dirty sectors, in ascending order. */
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      disk_sector_t sector;
+      size_t j;
+
+      lock_acquire (&b->block_lock);
+      sector = b->dirty && !b->pinned ? b->sector : INVALID_SECTOR;
+      lock_release (&b->block_lock);
+      if (sector == INVALID_SECTOR)
+        continue;
+
+      for (j = cnt++; j > 0 && sectors[j - 1] > sector; j--)
+        sectors[j] = sectors[j - 1];
+      sectors[j] = sector;
+    }
+
+  /* Write them back.  A block that is busy is written alone,
+     once we can lock it. */
+  for (i = 0; i < cnt; i += n)
+    {
+      n = write_run (sectors + i, cnt - i);
+      if (n == 0)
+        {
+          struct cache_block *b = cache_lock (sectors[i], EXCLUSIVE);
+          if (!b->pinned)
+            {
+              lock_acquire (&b->data_lock);
+              write_back (b);
+              lock_release (&b->data_lock);
+            }
+          cache_unlock (b);
+          n = 1;
+        }
+    }
+}
+
+/* Waits, if most of the cache is dirty, until the flusher has
+   written enough of it back.  Writers call this before dirtying
+   a block, while holding no block locks.
+
+   Does not wait inside a journal operation: the transaction's
+   pinned blocks count as dirty but cannot be written back until
+   it commits, which it will not do while the operation runs. */
+void
+cache_throttle (void)
+{
+  if (thread_current ()->journal_depth > 0)
+    return;
+
+  lock_acquire (&dirty_lock);
+  if (dirty_cnt >= THROTTLE_DIRTY_CNT)
+    {
+      throttle_cnt++;
+      wake_flusher ();
+      do
+        cond_wait (&dirty_drained, &dirty_lock);
+      while (dirty_cnt >= THROTTLE_DIRTY_CNT);
+    }
+  lock_release (&dirty_lock);
+}
+
+/* Locks block B, which is cached for some sector, as TYPE.
+   B's block_lock must be held; it is released. */
+static void
+lock_block (struct cache_block *b, enum lock_type type)
+{
+  if (type == NON_EXCLUSIVE)
+    {
+      b->read_waiters++;
+      if (b->writers || b->write_waiters)
+        do {
+          cond_wait (&b->no_writers, &b->block_lock);
+        } while (b->writers);
+      b->readers++;
+      b->read_waiters--;
+    }
+  else
+    {
+      b->write_waiters++;
+      if (b->readers || b->read_waiters || b->writers)
+        do {
+          cond_wait (&b->no_readers_or_writers, &b->block_lock);
+        } while (b->readers || b->writers);
+      b->writers++;
+      b->write_waiters--;
+    }
+  lock_release (&b->block_lock);
+}
+
+/* Locks the given SECTOR into the cache and returns the cache
+   block.
+   If TYPE is EXCLUSIVE, then the block returned will be locked
+   only by the caller.  The calling thread must not already
+   have any block locked.
+   If TYPE is NON_EXCLUSIVE, then block returned may be locked by
+   any number of other callers.  The calling thread may already
+   have any number of blocks locked NON_EXCLUSIVE. */
+struct cache_block *
+cache_lock (disk_sector_t sector, enum lock_type type)
+{
+  return lock_sector (sector, type, false);
+}
+
+/* Does the work of cache_lock().  If ONLY_NEW is true, returns a
+   null pointer instead of waiting for a block that already caches
+   SECTOR, so that the block returned, if any, is one that no one
+   else can hold. */
+static struct cache_block *
+lock_sector (disk_sector_t sector, enum lock_type type, bool only_new)
+{
+  int i;
+
+ try_again:
+  lock_acquire (&cache_sync);
+
+  /* Is the block already in-cache? */
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      lock_acquire (&b->block_lock);
+      if (b->sector != sector)
+        {
+          lock_release (&b->block_lock);
+          continue;
+        }
+      if (only_new)
+        {
+          lock_release (&b->block_lock);
+          lock_release (&cache_sync);
+          return NULL;
+        }
+      lock_release (&cache_sync);
+      lock_block (b, type);
+
+      /* Our sector could have been evicted while we waited. */
+      if (b->sector != sector)
+        {
+          cache_unlock (b);
+          goto try_again;
+        }
+      b->accessed = true;
+      hit_cnt++;
+      return b;
+    }
+
+  /* Not in cache.  Find empty slot.
+     We hold cache_sync. */
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      lock_acquire (&b->block_lock);
+      if (b->sector == INVALID_SECTOR)
+        {
+          /* Drop block_lock, which is no longer needed because
+             this is the only code that allocates free blocks,
+             and we still have cache_sync.
+
+             We can't drop cache_sync yet because someone else
+             might try to allocate this same block (or read from
+             it) while we're still initializing the block. */
+          lock_release (&b->block_lock);
+
+          b->sector = sector;
+          b->accessed = true;
+          b->up_to_date = false;
+          ASSERT (!b->dirty);
+          ASSERT (b->readers == 0);
+          ASSERT (b->writers == 0);
+          if (type == NON_EXCLUSIVE)
+            b->readers = 1;
+          else
+            b->writers = 1;
+          miss_cnt++;
+          lock_release (&cache_sync);
+          return b;
+        }
+      lock_release (&b->block_lock);
+    }
+
+  /* No empty slots.  Evict something, in clock order.
+     We hold cache_sync. */
+  for (i = 0; i < CACHE_CNT * 2; i++)
+    {
+      /* Get a block. */
+      struct cache_block *b = &cache[hand];
+      if (++hand >= CACHE_CNT)
+        hand = 0;
+
+      /* Try to grab exclusive write access to block. */
+      lock_acquire (&b->block_lock);
+      if (b->readers || b->writers || b->read_waiters || b->write_waiters
+          || b->pinned)
+        {
+          lock_release (&b->block_lock);
+          continue;
+        }
+      if (b->accessed)
+        {
+          /* Second chance. */
+          b->accessed = false;
+          lock_release (&b->block_lock);
+          continue;
+        }
+      b->writers = 1;
+      lock_release (&b->block_lock);
+
+      lock_release (&cache_sync);
+
+      /* Write block to disk if dirty. */
+      lock_acquire (&b->data_lock);
+      write_back (b);
+      lock_release (&b->data_lock);
+
+      /* Remove block from cache, if possible: someone might have
+         started waiting on it while the lock was released. */
+      lock_acquire (&b->block_lock);
+      b->writers = 0;
+      if (!b->read_waiters && !b->write_waiters)
+        {
+          /* No one is waiting for it, so we can free it. */
+          b->sector = INVALID_SECTOR;
+        }
+      else
+        {
+          /* There is a waiter.  Give it the block. */
+          if (b->read_waiters)
+            cond_broadcast (&b->no_writers, &b->block_lock);
+          else
+            cond_signal (&b->no_readers_or_writers, &b->block_lock);
+        }
+      lock_release (&b->block_lock);
+
+      /* Try again. */
+      goto try_again;
+    }
+
+  /* Wait for cache contention to die down. */
+  lock_release (&cache_sync);
+  timer_msleep (1000);
+  goto try_again;
+}
+
+/* Bring block B up-to-date, by reading it from disk if
+   necessary, and return a pointer to its data.
+   The caller must have an exclusive or non-exclusive lock on
+   B. */
+void *
+cache_read (struct cache_block *b)
+{
+  lock_acquire (&b->data_lock);
+  if (!b->up_to_date)
+    {
+      ASSERT (!b->dirty);
+      disk_read (filesys_disk, b->sector, b->data);
+      b->up_to_date = true;
+    }
+  lock_release (&b->data_lock);
+
+  return b->data;
+}
+
+/* Zero out block B, without reading it from disk, and return a
+   pointer to the zeroed data.
+   The caller must have an exclusive lock on B. */
+void *
+cache_zero (struct cache_block *b)
+{
+  ASSERT (b->writers);
+  memset (b->data, 0, DISK_SECTOR_SIZE);
+  b->up_to_date = true;
+  set_dirty (b, true);
+
+  return b->data;
+}
+
+/* Marks block B as dirty, so that it will be written back to
+   disk before eviction.
+   The caller must have a read or write lock on B,
+   and B must be up-to-date. */
+void
+cache_dirty (struct cache_block *b)
+{
+  ASSERT (b->up_to_date);
+  set_dirty (b, true);
+}
+
+/* Pins block B in the cache: it will not be written back or
+   evicted until cache_unpin() is called for it.
+   The caller must have an exclusive lock on B. */
+void
+cache_pin (struct cache_block *b)
+{
+  ASSERT (b->writers);
+  lock_acquire (&b->block_lock);
+  b->pinned = true;
+  lock_release (&b->block_lock);
+}
+
+/* Undoes cache_pin() for block B, which may then be written back
+   and evicted as usual.
+   The caller must have an exclusive lock on B. */
+void
+cache_unpin (struct cache_block *b)
+{
+  ASSERT (b->writers);
+  lock_acquire (&b->block_lock);
+  b->pinned = false;
+  lock_release (&b->block_lock);
+}
+
+/* Returns the sector cached in block B.
+   The caller must have a lock on B. */
+disk_sector_t
+cache_get_sector (const struct cache_block *b)
+{
+  return b->sector;
+}
+
+/* Unlocks block B.
+   If B is no longer locked by any thread, then it becomes a
+   candidate for immediate eviction. */
+void
+cache_unlock (struct cache_block *b)
+{
+  lock_acquire (&b->block_lock);
+  if (b->readers)
+    {
+      ASSERT (b->writers == 0);
+      if (--b->readers == 0)
+        cond_signal (&b->no_readers_or_writers, &b->block_lock);
+    }
+  else if (b->writers)
+    {
+      ASSERT (b->readers == 0);
+      ASSERT (b->writers == 1);
+      b->writers--;
+      if (b->read_waiters)
+        cond_broadcast (&b->no_writers, &b->block_lock);
+      else
+        cond_signal (&b->no_readers_or_writers, &b->block_lock);
+    }
+  else
+    NOT_REACHED ();
+  lock_release (&b->block_lock);
+}
+
+/* If SECTOR is in the cache, evicts it immediately without
+   writing it back to disk (even if dirty).
+   The block must be entirely unlocked. */
+void
+cache_free (disk_sector_t sector)
+{
+  int i;
+
+  lock_acquire (&cache_sync);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+
+      lock_acquire (&b->block_lock);
+      if (b->sector == sector)
+        {
+          lock_release (&cache_sync);
+
+          /* Only invalidate the block if it's unused.  That
+             should be the normal case, but it could be part of a
+             read-ahead (in readahead_daemon()) or lookup (in
+             cache_lock()) that's in progress. */
+          if (b->readers == 0 && b->read_waiters == 0
+              && b->writers == 0 && b->write_waiters == 0)
+            {
+              set_dirty (b, false);
+              b->pinned = false;
+              b->sector = INVALID_SECTOR;
+            }
+
+          lock_release (&b->block_lock);
+          return;
+        }
+      lock_release (&b->block_lock);
+    }
+  lock_release (&cache_sync);
+}
+
+/* Queues SECTOR to be read into the cache in the background. */
+void
+cache_readahead (disk_sector_t sector)
+{
+  struct readahead_s *ra;
+
+  lock_acquire (&readahead_lock);
+  if (readahead_queued < READAHEAD_QUEUE_MAX
+      && (ra = malloc (sizeof *ra)) != NULL)
+    {
+      ra->sector = sector;
+      list_push_back (&readahead_list, &ra->list_elem);
+      readahead_queued++;
+      cond_signal (&need_readahead, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Removes the sector at the head of the read-ahead queue and
+   stores it into *SECTOR.  If WAIT is true, waits for one to be
+   queued; otherwise, returns false if the head is not SECTOR. */
+static bool
+dequeue_readahead (disk_sector_t *sector, bool wait)
+{
+  struct readahead_s *ra;
+
+  lock_acquire (&readahead_lock);
+  if (wait)
+    while (list_empty (&readahead_list))
+      cond_wait (&need_readahead, &readahead_lock);
+  if (list_empty (&readahead_list)
+      || (!wait && list_entry (list_front (&readahead_list),
+                               struct readahead_s, list_elem)->sector
+                   != *sector))
+    {
+      lock_release (&readahead_lock);
+      return false;
+    }
+  ra = list_entry (list_pop_front (&readahead_list),
+                   struct readahead_s, list_elem);
+  readahead_queued--;
+  lock_release (&readahead_lock);
+
+  *sector = ra->sector;
+  free (ra);
+  return true;
+}
+
+/* Brings the CNT blocks in RUN, which the caller has locked and
+   which cache consecutive sectors, up to date, reading them from
+   disk with one request. */
+static void
+read_run (struct cache_block *run[], size_t cnt)
+{
+  size_t i;
+
+  if (cnt == 1)
+    {
+      if (!run[0]->up_to_date)
+        readahead_cnt++;
+      cache_read (run[0]);
+      return;
+    }
+
+  lock_acquire (&run_lock);
+  disk_read_multiple (filesys_disk, run[0]->sector, cnt, run_buffer);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_block *b = run[i];
+
+      lock_acquire (&b->data_lock);
+      if (!b->up_to_date)
+        {
+          memcpy (b->data, run_buffer[i], DISK_SECTOR_SIZE);
+          b->up_to_date = true;
+          readahead_cnt++;
+        }
+      lock_release (&b->data_lock);
+    }
+  lock_release (&run_lock);
+}
+
+/* Read-ahead thread: reads queued sectors into the cache.  A
+   sector that must be read from disk is read along with the
+   sectors queued right behind it that follow it on disk and are
+   not yet cached. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_block *run[RUN_MAX];
+      disk_sector_t sector;
+      size_t cnt = 0;
+      size_t i;
+
+      dequeue_readahead (&sector, true);
+      run[cnt++] = cache_lock (sector, NON_EXCLUSIVE);
+      if (!run[0]->up_to_date)
+        while (cnt < RUN_MAX)
+          {
+            disk_sector_t next = sector + cnt;
+            if (!dequeue_readahead (&next, false))
+              break;
+            run[cnt] = lock_sector (next, NON_EXCLUSIVE, true);
+            if (run[cnt] == NULL)
+              break;
+            cnt++;
+          }
+
+      read_run (run, cnt);
+      for (i = 0; i < cnt; i++)
+        cache_unlock (run[i]);
+    }
+}
+
+/* Flusher thread: waits until woken by flush_timer(), by
+   set_dirty() above FLUSH_DIRTY_CNT dirty blocks, or by a
+   throttled writer, then writes dirty blocks back, committing
+   the journal's running transaction along with them. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      bool due;
+
+      lock_acquire (&dirty_lock);
+      while (!flush_wanted)
+        cond_wait (&need_flush, &dirty_lock);
+      flush_wanted = false;
+      due = dirty_cnt > 0;
+      lock_release (&dirty_lock);
+      if (due)
+        journal_commit ();
+    }
+}
+
+/* Flush timer thread: wakes the flusher every
+   cache_flush_interval ticks. */
+static void
+flush_timer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (cache_flush_interval > 0 ? cache_flush_interval : 1);
+      lock_acquire (&dirty_lock);
+      wake_flusher ();
+      lock_release (&dirty_lock);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %lld hits, %lld misses, %lld writebacks, "
+          "%lld sectors read ahead, %lld throttled writes\n",
+          hit_cnt, miss_cnt, writeback_cnt, readahead_cnt, throttle_cnt);
+}
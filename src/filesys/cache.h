@@ -0,0 +1,42 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdint.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+
+/* Default interval between periodic flushes, in timer ticks. */
+#define CACHE_FLUSH_INTERVAL_DEFAULT (5 * TIMER_FREQ)
+
+/* Ticks between periodic flushes. */
+extern int64_t cache_flush_interval;
+
+/* Most blocks that may be pinned at once.  Pinned blocks cannot
+   be evicted, so this leaves half the cache for everything else,
+   and keeps pinned blocks alone from reaching the dirty count at
+   which writers are throttled. */
+#define CACHE_PIN_MAX 32
+
+/* Type of block lock. */
+enum lock_type
+  {
+    NON_EXCLUSIVE,              /* Any number of lockers. */
+    EXCLUSIVE                   /* Only one locker. */
+  };
+
+void cache_init (void);
+void cache_flush (void);
+void cache_throttle (void);
+struct cache_block *cache_lock (disk_sector_t, enum lock_type);
+void *cache_read (struct cache_block *);
+void *cache_zero (struct cache_block *);
+void cache_dirty (struct cache_block *);
+void cache_pin (struct cache_block *);
+void cache_unpin (struct cache_block *);
+disk_sector_t cache_get_sector (const struct cache_block *);
+void cache_unlock (struct cache_block *);
+void cache_free (disk_sector_t);
+void cache_readahead (disk_sector_t);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
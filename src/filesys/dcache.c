@@ -0,0 +1,183 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the results of recent directory lookups, keyed by
+   the directory's inode sector and the name looked up, so that
+   repeated opens of the same names need not read the directory.
+   A lookup that found nothing is remembered too, as a negative
+   entry with sector 0.  dir_add() and dir_remove() invalidate the
+   entries for the names they change.  When all DCACHE_CNT
+   entries are in use, the least recently used one is replaced. */
+
+#define DCACHE_CNT 64
+
+/* A cached lookup result. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in `dentries'. */
+    struct list_elem lru_elem;          /* Element in `lru'. */
+    bool in_use;                        /* In `dentries'? */
+    disk_sector_t dir;                  /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Name looked up. */
+    disk_sector_t sector;               /* Inode sector, or 0 if none. */
+  };
+
+static struct dentry dcache[DCACHE_CNT];
+static struct hash dentries;            /* Entries in use. */
+static struct list lru;                 /* All entries, most recent first. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups answered. */
+static long long negative_hit_cnt;      /* ...with "no such file". */
+static long long miss_cnt;              /* Lookups not answered. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_CNT; i++)
+    {
+      dcache[i].in_use = false;
+      list_push_back (&lru, &dcache[i].lru_elem);
+    }
+}
+
+/* Returns the entry for NAME in directory DIR, or a null pointer
+   if there is none.  The caller must hold dcache_lock. */
+static struct dentry *
+find (disk_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in directory DIR.  If the result of an earlier
+   lookup is cached, stores the inode sector found, or 0 if none
+   was, into *SECTORP and returns true.  Otherwise returns
+   false. */
+bool
+dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+      *sectorp = d->sector;
+      hit_cnt++;
+      if (d->sector == 0)
+        negative_hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that looking up NAME in directory DIR yields the inode
+   in SECTOR, or nothing if SECTOR is 0. */
+void
+dcache_insert (disk_sector_t dir, const char *name, disk_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      /* Replace the least recently used entry. */
+      d = list_entry (list_back (&lru), struct dentry, lru_elem);
+      if (d->in_use)
+        hash_delete (&dentries, &d->hash_elem);
+      d->in_use = true;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_remove (&d->lru_elem);
+  list_push_front (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets any cached lookup of NAME in directory DIR. */
+void
+dcache_invalidate (disk_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->hash_elem);
+      d->in_use = false;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %lld hits (%lld negative), %lld misses\n",
+          hit_cnt, negative_hit_cnt, miss_cnt);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
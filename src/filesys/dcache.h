@@ -0,0 +1,13 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+void dcache_init (void);
+bool dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *);
+void dcache_insert (disk_sector_t dir, const char *name, disk_sector_t);
+void dcache_invalidate (disk_sector_t dir, const char *name);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
@@ -1,9 +1,14 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -21,6 +26,31 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Hash index.
+
+   A directory with more than INDEX_THRESHOLD entry slots gets a
+   hash index, kept in a separate inode recorded in the
+   directory's inode.  The directory's entries stay where they
+   are, so dir_readdir() sees them in the same order as before;
+   the index only maps the hash of each name in use to its
+   entry's slot, by open addressing with linear probing.  It is
+   rebuilt, larger if the directory has grown, whenever more than
+   half its buckets have been used. */
+#define INDEX_THRESHOLD 64
+#define INDEX_MIN_BUCKETS 256
+
+/* Bucket values other than these are an entry slot plus 1. */
+#define BUCKET_EMPTY 0                  /* Never used. */
+#define BUCKET_DELETED UINT32_MAX       /* Entry was removed. */
+
+/* Start of a hash index.  The buckets follow. */
+struct index_header
+  {
+    uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+    uint32_t used_cnt;                  /* Buckets not BUCKET_EMPTY. */
+    uint32_t free_hint;                 /* No free entry slot before this. */
+  };
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -37,6 +67,7 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      inode_journal_data (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -83,6 +114,201 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the hash index of DIR, opened, or a null pointer if
+   DIR has none.  The caller must close it. */
+static struct inode *
+open_index (const struct dir *dir)
+{
+  disk_sector_t sector = inode_get_dir_index (dir->inode);
+  struct inode *index = sector != 0 ? inode_open (sector) : NULL;
+
+  if (index != NULL)
+    inode_journal_data (index);
+  return index;
+}
+
+/* Reads the header of hash index INDEX into *H. */
+static void
+read_header (struct inode *index, struct index_header *h)
+{
+  inode_read_at (index, h, sizeof *h, 0);
+}
+
+/* Writes *H as the header of hash index INDEX. */
+static void
+write_header (struct inode *index, const struct index_header *h)
+{
+  inode_write_at (index, h, sizeof *h, 0);
+}
+
+/* Returns the value of bucket IDX in hash index INDEX. */
+static uint32_t
+read_bucket (struct inode *index, uint32_t idx)
+{
+  uint32_t value;
+  inode_read_at (index, &value, sizeof value,
+                 sizeof (struct index_header) + idx * sizeof value);
+  return value;
+}
+
+/* Sets bucket IDX in hash index INDEX to VALUE. */
+static void
+write_bucket (struct inode *index, uint32_t idx, uint32_t value)
+{
+  inode_write_at (index, &value, sizeof value,
+                  sizeof (struct index_header) + idx * sizeof value);
+}
+
+/* Searches hash index INDEX of DIR, with header *H, for NAME.
+   If found, returns true, stores the entry into *EP and its
+   offset into *OFSP, if they are non-null, and stores its bucket
+   into *BUCKETP.  Otherwise, returns false and stores into
+   *BUCKETP the bucket where NAME should be inserted.
+   Probes each bucket at most once, so that a search ends even if
+   no bucket is empty; index_add() never lets that happen in an
+   index it keeps, so the insertion bucket is always free. */
+static bool
+index_lookup (const struct dir *dir, struct inode *index,
+              const struct index_header *h, const char *name,
+              struct dir_entry *ep, off_t *ofsp, uint32_t *bucketp)
+{
+  uint32_t mask = h->bucket_cnt - 1;
+  uint32_t idx = hash_string (name) & mask;
+  uint32_t insert = BUCKET_DELETED;
+  uint32_t i;
+
+  for (i = 0; i < h->bucket_cnt; i++, idx = (idx + 1) & mask)
+    {
+      uint32_t value = read_bucket (index, idx);
+      struct dir_entry e;
+      off_t ofs;
+
+      if (value == BUCKET_EMPTY)
+        break;
+      else if (value == BUCKET_DELETED)
+        {
+          if (insert == BUCKET_DELETED)
+            insert = idx;
+          continue;
+        }
+
+      ofs = (value - 1) * sizeof e;
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+          && e.in_use && !strcmp (name, e.name))
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          *bucketp = idx;
+          return true;
+        }
+    }
+
+  *bucketp = insert != BUCKET_DELETED ? insert : idx;
+  return false;
+}
+
+/* Fills hash index INDEX with the entries in use in DIR, using
+   BUCKET_CNT buckets. */
+static void
+index_build (const struct dir *dir, struct inode *index, uint32_t bucket_cnt)
+{
+  static const uint32_t zeros[DISK_SECTOR_SIZE / sizeof (uint32_t)];
+  struct index_header h;
+  struct dir_entry e;
+  uint32_t i, slot;
+
+  /* Empty all the buckets. */
+  h.bucket_cnt = bucket_cnt;
+  h.used_cnt = 0;
+  h.free_hint = UINT32_MAX;
+  for (i = 0; i < bucket_cnt; i += sizeof zeros / sizeof *zeros)
+    {
+      uint32_t cnt = bucket_cnt - i;
+      if (cnt > sizeof zeros / sizeof *zeros)
+        cnt = sizeof zeros / sizeof *zeros;
+      inode_write_at (index, zeros, cnt * sizeof *zeros,
+                      sizeof h + i * sizeof *zeros);
+    }
+
+  /* Insert every entry in use.  BUCKET_CNT is at least four times
+     the number of entry slots, so each probe finds an empty
+     bucket. */
+  for (slot = 0;
+       inode_read_at (dir->inode, &e, sizeof e, slot * sizeof e) == sizeof e;
+       slot++)
+    if (e.in_use)
+      {
+        uint32_t idx;
+        for (idx = hash_string (e.name) & (bucket_cnt - 1);
+             read_bucket (index, idx) != BUCKET_EMPTY;
+             idx = (idx + 1) & (bucket_cnt - 1))
+          continue;
+        write_bucket (index, idx, slot + 1);
+        h.used_cnt++;
+      }
+    else if (h.free_hint == UINT32_MAX)
+      h.free_hint = slot;
+  if (h.free_hint == UINT32_MAX)
+    h.free_hint = slot;
+
+  write_header (index, &h);
+}
+
+/* Returns the number of buckets for a hash index of DIR: enough
+   that the index is at most a quarter full even if every entry
+   slot is in use. */
+static uint32_t
+index_size (const struct dir *dir)
+{
+  uint32_t slot_cnt = inode_length (dir->inode) / sizeof (struct dir_entry);
+  uint32_t bucket_cnt;
+
+  for (bucket_cnt = INDEX_MIN_BUCKETS; bucket_cnt < slot_cnt * 4;
+       bucket_cnt *= 2)
+    continue;
+  return bucket_cnt;
+}
+
+/* Gives DIR a new hash index, in place of any it has.  The index
+   is built in a new inode, whose data is not journaled, and only
+   then recorded in DIR's inode, so that the journal need not hold
+   every bucket of a large index at once.  It must still hold the
+   new inode's index blocks, which the caller's journal operation
+   is extended to cover.
+   Returns true if successful.  Returns false, and does nothing,
+   if DIR has too few entry slots to need an index, if the
+   journal has no room, or if disk or memory allocation fails,
+   since DIR still works without one. */
+static bool
+index_create (struct dir *dir)
+{
+  off_t slot_cnt = inode_length (dir->inode) / sizeof (struct dir_entry);
+  uint32_t bucket_cnt;
+  disk_sector_t sector;
+  struct inode *index;
+
+  if (slot_cnt <= INDEX_THRESHOLD)
+    return false;
+  bucket_cnt = index_size (dir);
+  if (!journal_extend (inode_index_blocks (sizeof (struct index_header)
+                                           + bucket_cnt * sizeof (uint32_t))
+                       + 2)
+      || !free_map_allocate (1, inode_get_inumber (dir->inode), &sector))
+    return false;
+  if (!inode_create (sector, 0) || (index = inode_open (sector)) == NULL)
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+
+  index_build (dir, index, bucket_cnt);
+  inode_set_dir_index (dir->inode, sector);
+  inode_close (index);
+  return true;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -93,11 +319,25 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
+  struct inode *index;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = open_index (dir);
+  if (index != NULL)
+    {
+      struct index_header h;
+      uint32_t bucket;
+      bool found;
+
+      read_header (index, &h);
+      found = index_lookup (dir, index, &h, name, ep, ofsp, &bucket);
+      inode_close (index);
+      return found;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -114,24 +354,89 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Consults the directory entry cache first, and records the
+   result there.  The lookup, whether it hits in the cache or
+   not, and the opening of the inode found happen under DIR's
+   lock, which dir_add() and dir_remove() hold while they change
+   DIR and invalidate its cache entries.  Otherwise a file could
+   be removed, and its inode sector freed and reused, between
+   finding the entry and opening the inode. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  disk_sector_t dir_sector;
+  disk_sector_t sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock_dir (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+      dcache_insert (dir_sector, name, sector);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
 
+/* Adds a file named NAME in sector INODE_SECTOR to DIR, which
+   has hash index INDEX, unless DIR already has a file by that
+   name.
+   Returns true if successful, false on failure. */
+static bool
+index_add (struct dir *dir, struct inode *index, const char *name,
+           disk_sector_t inode_sector)
+{
+  struct index_header h;
+  struct dir_entry e;
+  uint32_t bucket, slot;
+
+  read_header (index, &h);
+  if (index_lookup (dir, index, &h, name, NULL, NULL, &bucket))
+    return false;
+
+  /* Find a free slot, or the end of the directory, starting from
+     the first slot that might be free. */
+  for (slot = h.free_hint;
+       inode_read_at (dir->inode, &e, sizeof e, slot * sizeof e) == sizeof e;
+       slot++)
+    if (!e.in_use)
+      break;
+
+  /* Write slot. */
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (inode_write_at (dir->inode, &e, sizeof e, slot * sizeof e) != sizeof e)
+    return false;
+
+  /* Index it.  If the index is over half full, replace it.  If
+     that fails and it has no empty bucket left, drop it instead,
+     leaving DIR to linear search until index_create() can try
+     again. */
+  if (read_bucket (index, bucket) == BUCKET_EMPTY)
+    h.used_cnt++;
+  write_bucket (index, bucket, slot + 1);
+  h.free_hint = slot + 1;
+  if (h.used_cnt * 2 > h.bucket_cnt && index_create (dir))
+    inode_remove (index);
+  else if (h.used_cnt >= h.bucket_cnt)
+    {
+      inode_set_dir_index (dir->inode, 0);
+      inode_remove (index);
+    }
+  else
+    write_header (index, &h);
+  return true;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -142,6 +447,7 @@ bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) 
 {
   struct dir_entry e;
+  struct inode *index;
   off_t ofs;
   bool success = false;
   
@@ -152,6 +458,15 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  inode_lock_dir (dir->inode);
+  index = open_index (dir);
+  if (index != NULL)
+    {
+      success = index_add (dir, index, name, inode_sector);
+      inode_close (index);
+      goto done;
+    }
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
@@ -174,7 +489,13 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Index the directory once it gets big. */
+  if (success)
+    index_create (dir);
+
  done:
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
@@ -186,6 +507,9 @@ dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct inode *index;
+  struct index_header h;
+  uint32_t bucket = 0;
   bool success = false;
   off_t ofs;
 
@@ -193,7 +517,15 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  inode_lock_dir (dir->inode);
+  index = open_index (dir);
+  if (index != NULL)
+    {
+      read_header (index, &h);
+      if (!index_lookup (dir, index, &h, name, &e, &ofs, &bucket))
+        goto done;
+    }
+  else if (!lookup (dir, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
@@ -206,12 +538,26 @@ dir_remove (struct dir *dir, const char *name)
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  /* Drop it from the index. */
+  if (index != NULL)
+    {
+      write_bucket (index, bucket, BUCKET_DELETED);
+      if (ofs / sizeof e < h.free_hint)
+        {
+          h.free_hint = ofs / sizeof e;
+          write_header (index, &h);
+        }
+    }
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
+  inode_close (index);
   return success;
 }
 
@@ -222,15 +568,19 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  inode_lock_dir (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  inode_unlock_dir (dir->inode);
+  return success;
 }
@@ -1,6 +1,7 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/disk.h"
 #include "threads/malloc.h"
 
 /* An open file. */
@@ -9,8 +10,56 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Sequential read-ahead state. */
+    off_t ra_next;              /* Offset a sequential read starts at. */
+    off_t ra_end;               /* End of data already read ahead. */
+    size_t ra_window;           /* Window in sectors, 0 if random. */
   };
 
+/* Maximum read-ahead window, in sectors.
+   Controlled by kernel command-line option "-ra". */
+size_t readahead_max = READAHEAD_MAX_DEFAULT;
+
+/* Read-ahead window after the first sequential read, in
+   sectors. */
+#define READAHEAD_INITIAL 4
+
+/* Updates FILE's read-ahead state after BYTES_READ bytes were
+   read at offset OFS.  A read that starts where the previous one
+   ended continues a sequential run: the window doubles, up to
+   readahead_max sectors, and sectors up to a window past the
+   read are fetched into the buffer cache in the background.
+   Any other read closes the window. */
+static void
+readahead (struct file *file, off_t ofs, off_t bytes_read)
+{
+  off_t start, end;
+
+  if (ofs != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = ofs + bytes_read;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = READAHEAD_INITIAL;
+  else
+    file->ra_window *= 2;
+  if (file->ra_window > readahead_max)
+    file->ra_window = readahead_max;
+  file->ra_next = ofs + bytes_read;
+
+  if (file->ra_window == 0)
+    return;
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window * DISK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_readahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -69,6 +118,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -87,9 +137,9 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up or the
+   maximum file size is reached.  Writing past end of file
+   extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +152,9 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up or the
+   maximum file size is reached.  Writing past end of file
+   extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -1,10 +1,17 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+/* Default maximum read-ahead window, in sectors. */
+#define READAHEAD_MAX_DEFAULT 32
+
+/* Maximum read-ahead window, in sectors; 0 disables read-ahead. */
+extern size_t readahead_max;
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -1,16 +1,35 @@
 #include "filesys/filesys.h"
 #include <debug.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* Sectors per file system block. */
+size_t block_sectors = 1;
+
+/* Superblock, in sector SUPER_SECTOR.  A disk without one has
+   one-sector blocks.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+#define SUPER_MAGIC 0x53555052
+struct superblock
+  {
+    unsigned magic;                     /* SUPER_MAGIC. */
+    uint32_t block_sectors;             /* Sectors per block. */
+    uint8_t unused[DISK_SECTOR_SIZE - 8];
+  };
+
+static void read_super (void);
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -18,17 +37,34 @@ static void do_format (void);
 void
 filesys_init (bool format) 
 {
+  struct inode *root;
+
   filesys_disk = disk_get (0, 1);
   if (filesys_disk == NULL)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+  cache_init ();
+  dcache_init ();
   inode_init ();
+  if (!format)
+    read_super ();
   free_map_init ();
+  journal_init ();
 
   if (format) 
     do_format ();
+  else
+    journal_open ();
 
   free_map_open ();
+
+  /* New inodes take the format of the root directory, which was
+     chosen when the disk was formatted. */
+  root = inode_open (ROOT_DIR_SECTOR);
+  if (root == NULL)
+    PANIC ("can't open root directory");
+  inode_format = inode_get_format (root);
+  inode_close (root);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -37,9 +73,11 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_close ();
 }
 
-/* Creates a file named NAME with the given INITIAL_SIZE.
+/* Creates a file named NAME with the given INITIAL_SIZE.  The
+   new inode is placed near the directory's.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
@@ -47,14 +85,20 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   disk_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin (JOURNAL_OP_BLOCKS);
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && free_map_allocate (1, ROOT_DIR_SECTOR, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  free_map_sync ();
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -84,18 +128,51 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin (JOURNAL_OP_BLOCKS);
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
 
-/* Formats the file system. */
+/* Sets `block_sectors' from the superblock. */
+static void
+read_super (void)
+{
+  struct superblock sb;
+
+  ASSERT (sizeof sb == DISK_SECTOR_SIZE);
+  disk_read (filesys_disk, SUPER_SECTOR, &sb);
+  if (sb.magic == SUPER_MAGIC && sb.block_sectors >= 1
+      && sb.block_sectors <= BLOCK_SECTORS_MAX
+      && (sb.block_sectors & (sb.block_sectors - 1)) == 0)
+    block_sectors = sb.block_sectors;
+  else
+    block_sectors = 1;
+}
+
+/* Formats the file system, using the inode format in
+   `inode_format' and blocks of `block_sectors' sectors. */
 static void
 do_format (void)
 {
+  struct superblock sb;
+
+  if (block_sectors < 1 || block_sectors > BLOCK_SECTORS_MAX
+      || (block_sectors & (block_sectors - 1)) != 0)
+    PANIC ("block size must be 1, 2, 4, or 8 sectors");
+
   printf ("Formatting file system...");
+  memset (&sb, 0, sizeof sb);
+  sb.magic = SUPER_MAGIC;
+  sb.block_sectors = block_sectors;
+  disk_write (filesys_disk, SUPER_SECTOR, &sb);
+  journal_create ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
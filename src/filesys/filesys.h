@@ -2,11 +2,22 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* Journal header sector. */
+#define SUPER_SECTOR 3          /* Superblock sector. */
+
+/* Largest file system block, in sectors. */
+#define BLOCK_SECTORS_MAX 8
+
+/* Sectors per file system block, the unit in which sectors are
+   allocated.  Read from the superblock, or set by kernel
+   command-line option "-bs" for formatting. */
+extern size_t block_sectors;
 
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
@@ -1,51 +1,288 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct bitmap *free_map;      /* Free map, one bit per block. */
+
+/* Sectors of the free map file that differ from FREE_MAP, one bit
+   per file sector.  Allocation and release only mark sectors
+   here; free_map_sync() writes them back. */
+static struct bitmap *dirty_sectors;
+
+/* Protects the free map, DIRTY_SECTORS and the group free
+   counts.  free_map_sync() holds it while it writes, and may be
+   called back by way of inode_write_at(). */
+static struct lock free_map_lock;
+
+/* Sectors are allocated and released in whole blocks of
+   `block_sectors' sectors, block N being the sectors that start
+   at sector N * block_sectors.  The functions below that take
+   sector numbers and counts round them out to blocks. */
+
+/* Allocation groups.
+
+   The disk is divided into groups of GROUP_BLOCKS blocks, the
+   number whose bits fit in one free map sector.  Allocation
+   searches the group that holds the caller's goal block first,
+   then the following groups in turn, skipping any group whose
+   free count shows that it cannot satisfy the request. */
+#define GROUP_BLOCKS (DISK_SECTOR_SIZE * 8)
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free;           /* Free blocks in each group. */
+
+static void count_free (void);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (disk_size (filesys_disk));
+  free_map = bitmap_create (disk_size (filesys_disk) / block_sectors);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, FREE_MAP_SECTOR / block_sectors);
+  bitmap_mark (free_map, ROOT_DIR_SECTOR / block_sectors);
+  bitmap_mark (free_map, JOURNAL_SECTOR / block_sectors);
+  bitmap_mark (free_map, SUPER_SECTOR / block_sectors);
+
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                               DISK_SECTOR_SIZE));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_BLOCKS);
+  group_free = malloc (sizeof *group_free * group_cnt);
+  if (group_free == NULL)
+    PANIC ("group table creation failed--disk is too large");
+  count_free ();
+  lock_init (&free_map_lock);
+}
+
+/* Returns the first block of group GROUP. */
+static inline size_t
+group_start (size_t group)
+{
+  return group * GROUP_BLOCKS;
+}
+
+/* Returns the block just past the end of group GROUP. */
+static inline size_t
+group_end (size_t group)
+{
+  size_t end = (group + 1) * GROUP_BLOCKS;
+  return end < bitmap_size (free_map) ? end : bitmap_size (free_map);
+}
+
+/* Recomputes the free count of every group from the free map. */
+static void
+count_free (void)
+{
+  size_t group;
+
+  for (group = 0; group < group_cnt; group++)
+    group_free[group] = bitmap_count (free_map, group_start (group),
+                                      group_end (group) - group_start (group),
+                                      false);
+}
+
+/* Adds DELTA to the free counts of the groups that hold the CNT
+   blocks starting at BLOCK. */
+static void
+adjust_free (size_t block, size_t cnt, int delta)
+{
+  while (cnt > 0)
+    {
+      size_t group = block / GROUP_BLOCKS;
+      size_t n = group_end (group) - block;
+      if (n > cnt)
+        n = cnt;
+      group_free[group] += delta * (int) n;
+      block += n;
+      cnt -= n;
+    }
+}
+
+/* Marks the free map file sectors that hold the bits for the CNT
+   blocks starting at BLOCK as needing writeback. */
+static void
+mark_dirty (size_t block, size_t cnt)
+{
+  size_t first = block / 8 / DISK_SECTOR_SIZE;
+  size_t last = (block + cnt - 1) / 8 / DISK_SECTOR_SIZE;
+
+  bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Returns the first of CNT consecutive free blocks that lie
+   between FROM and TO, or BITMAP_ERROR if there are none.  Each
+   candidate run that turns out to contain a used block is
+   skipped past that block, so the scan is linear in the size of
+   the range rather than proportional to it times CNT. */
+static size_t
+scan_range (size_t from, size_t to, size_t cnt)
+{
+  size_t block = from;
+
+  while (block + cnt <= to)
+    {
+      size_t used = bitmap_scan (free_map, block, 1, true);
+      if (used == BITMAP_ERROR || used >= block + cnt)
+        return block;
+      block = used + 1;
+    }
+  return BITMAP_ERROR;
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
-   Returns true if successful, false if all sectors were
+/* Allocates CNT consecutive sectors, rounded up to whole blocks,
+   from the free map and stores the first into *SECTORP.  Prefers
+   blocks at or after the one that holds sector GOAL in GOAL's
+   allocation group, then the groups after it, so that callers
+   can keep related data together by passing a nearby sector,
+   such as a file's inode or its last data sector.
+   Returns true if successful, false if not enough sectors were
    available. */
 bool
-free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
+free_map_allocate (size_t cnt, disk_sector_t goal, disk_sector_t *sectorp) 
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t block = BITMAP_ERROR;
+  size_t goal_block = goal / block_sectors;
+  size_t first_group, i;
+
+  cnt = DIV_ROUND_UP (cnt, block_sectors);
+  lock_acquire (&free_map_lock);
+  if (goal_block >= bitmap_size (free_map))
+    goal_block = 0;
+  first_group = goal_block / GROUP_BLOCKS;
+
+  if (cnt <= GROUP_BLOCKS)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      /* Search GOAL's group from GOAL, then each other group,
+         then the start of GOAL's group. */
+      for (i = 0; i <= group_cnt && block == BITMAP_ERROR; i++)
+        {
+          size_t group = (first_group + i) % group_cnt;
+          size_t from = group_start (group);
+          size_t to = group_end (group);
+
+          if (i == 0)
+            from = goal_block;
+          else if (i == group_cnt)
+            to = goal_block + cnt - 1 < to ? goal_block + cnt - 1 : to;
+          if (group_free[group] >= cnt)
+            block = scan_range (from, to, cnt);
+        }
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  if (block == BITMAP_ERROR)
+    {
+      /* Fall back to runs that cross group boundaries. */
+      block = scan_range (0, bitmap_size (free_map), cnt);
+      if (block == BITMAP_ERROR)
+        {
+          lock_release (&free_map_lock);
+          return false;
+        }
+    }
+
+  bitmap_set_multiple (free_map, block, cnt, true);
+  adjust_free (block, cnt, -1);
+  mark_dirty (block, cnt);
+  lock_release (&free_map_lock);
+  *sectorp = block * block_sectors;
+  return true;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates the CNT sectors starting at SECTOR, rounded up to
+   whole blocks, if they are all free.  SECTOR must start a
+   block.
+   Returns true if successful, false otherwise. */
+bool
+free_map_allocate_at (disk_sector_t sector, size_t cnt)
+{
+  size_t block = sector / block_sectors;
+  bool success = false;
+
+  ASSERT (sector % block_sectors == 0);
+  cnt = DIV_ROUND_UP (cnt, block_sectors);
+  lock_acquire (&free_map_lock);
+  if (block + cnt <= bitmap_size (free_map)
+      && bitmap_none (free_map, block, cnt))
+    {
+      bitmap_set_multiple (free_map, block, cnt, true);
+      adjust_free (block, cnt, -1);
+      mark_dirty (block, cnt);
+      success = true;
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Makes CNT sectors starting at SECTOR, rounded up to whole
+   blocks, available for use.  SECTOR must start a block. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  size_t block = sector / block_sectors;
+
+  ASSERT (sector % block_sectors == 0);
+  cnt = DIV_ROUND_UP (cnt, block_sectors);
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, block, cnt));
+  bitmap_set_multiple (free_map, block, cnt, false);
+  adjust_free (block, cnt, 1);
+  mark_dirty (block, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the free map sectors changed since the last call to the
+   free map file, in file order.  Callers that allocate sectors
+   call this before they make the sectors reachable from other
+   metadata, and callers that release sectors after they make
+   them unreachable, so that all of an operation's free map
+   changes reach the buffer cache as one batch and ahead of, or
+   behind, the metadata that depends on them.  Does nothing
+   before the free map file is open.  Runs as a journal
+   operation of its own if the caller is not in one. */
+void
+free_map_sync (void)
+{
+  size_t file_size = bitmap_file_size (free_map);
+  size_t i;
+
+  if (free_map_file == NULL || lock_held_by_current_thread (&free_map_lock))
+    return;
+
+  journal_begin (0);
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < bitmap_size (dirty_sectors); i++)
+    if (bitmap_test (dirty_sectors, i))
+      {
+        size_t ofs = i * DISK_SECTOR_SIZE;
+        size_t size = file_size - ofs;
+
+        if (size > DISK_SECTOR_SIZE)
+          size = DISK_SECTOR_SIZE;
+        bitmap_reset (dirty_sectors, i);
+        if (!bitmap_write_part (free_map, free_map_file, ofs, size))
+          PANIC ("can't write free map");
+      }
+  lock_release (&free_map_lock);
+  journal_end ();
+}
+
+/* Returns the number of sectors in the free map file, which is
+   the most that free_map_sync() can write at once. */
+size_t
+free_map_sector_cnt (void)
+{
+  return DIV_ROUND_UP (bitmap_file_size (free_map), DISK_SECTOR_SIZE);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -55,14 +292,17 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_journal_data (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_free ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_sync ();
   file_close (free_map_file);
 }
 
@@ -71,14 +311,36 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The write allocates the file's data
+     sectors, which must not in turn try to write the free map, so
+     FREE_MAP_FILE stays null until it is done; the sync then
+     writes back the sectors that record those allocations. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  inode_journal_data (file_get_inode (file));
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  free_map_file = file;
+  free_map_sync ();
+}
+
+/* Prints free map statistics, including the block size that the
+   disk was formatted with. */
+void
+free_map_print_stats (void)
+{
+  size_t free_cnt = 0;
+  size_t group;
+
+  for (group = 0; group < group_cnt; group++)
+    free_cnt += group_free[group];
+  printf ("Free map: %zu of %zu blocks free, %zu sectors per block\n",
+          free_cnt, bitmap_size (free_map), block_sectors);
 }
@@ -11,7 +11,11 @@ void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
 
-bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate (size_t, disk_sector_t goal, disk_sector_t *);
+bool free_map_allocate_at (disk_sector_t, size_t);
 void free_map_release (disk_sector_t, size_t);
+void free_map_sync (void);
+size_t free_map_sector_cnt (void);
+void free_map_print_stats (void);
 
 #endif /* filesys/free-map.h */
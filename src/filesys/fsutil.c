@@ -1,13 +1,15 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
-#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
@@ -92,9 +94,7 @@ fsutil_put (char **argv)
   printf ("Putting '%s' into the file system...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (DISK_SECTOR_SIZE);
-  if (buffer == NULL)
-    PANIC ("couldn't allocate buffer");
+  buffer = palloc_get_page (PAL_ASSERT);
 
   /* Open source disk and read file size. */
   src = disk_get (1, 0);
@@ -116,11 +116,13 @@ fsutil_put (char **argv)
   if (dst == NULL)
     PANIC ("%s: open failed", file_name);
 
-  /* Do copy. */
+  /* Do copy, a page at a time. */
   while (size > 0)
     {
-      int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-      disk_read (src, sector++, buffer);
+      int chunk_size = size > PGSIZE ? PGSIZE : size;
+      size_t sector_cnt = DIV_ROUND_UP (chunk_size, DISK_SECTOR_SIZE);
+      disk_read_multiple (src, sector, sector_cnt, buffer);
+      sector += sector_cnt;
       if (file_write (dst, buffer, chunk_size) != chunk_size)
         PANIC ("%s: write failed with %"PROTd" bytes unwritten",
                file_name, size);
@@ -129,7 +131,7 @@ fsutil_put (char **argv)
 
   /* Finish up. */
   file_close (dst);
-  free (buffer);
+  palloc_free_page (buffer);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch disk.
@@ -157,9 +159,7 @@ fsutil_get (char **argv)
   printf ("Getting '%s' from the file system...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (DISK_SECTOR_SIZE);
-  if (buffer == NULL)
-    PANIC ("couldn't allocate buffer");
+  buffer = palloc_get_page (PAL_ASSERT);
 
   /* Open source file. */
   src = filesys_open (file_name);
@@ -178,20 +178,132 @@ fsutil_get (char **argv)
   ((int32_t *) buffer)[1] = size;
   disk_write (dst, sector++, buffer);
   
-  /* Do copy. */
+  /* Do copy, a page at a time. */
   while (size > 0) 
     {
-      int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-      if (sector >= disk_size (dst))
+      int chunk_size = size > PGSIZE ? PGSIZE : size;
+      size_t sector_cnt = DIV_ROUND_UP (chunk_size, DISK_SECTOR_SIZE);
+      if (sector_cnt > disk_size (dst) - sector)
         PANIC ("%s: out of space on scratch disk", file_name);
       if (file_read (src, buffer, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, DISK_SECTOR_SIZE - chunk_size);
-      disk_write (dst, sector++, buffer);
+      memset (buffer + chunk_size, 0,
+              sector_cnt * DISK_SECTOR_SIZE - chunk_size);
+      disk_write_multiple (dst, sector, sector_cnt, buffer);
+      sector += sector_cnt;
       size -= chunk_size;
     }
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+  palloc_free_page (buffer);
+}
+
+/* Writes all dirty file system buffers to disk. */
+void
+fsutil_sync (char **argv UNUSED)
+{
+  printf ("Flushing file system buffers...\n");
+  journal_commit ();
+}
+
+/* Returns the number of runs of consecutive sectors that hold
+   INODE's data.  Sectors not yet allocated are skipped. */
+static int
+count_fragments (struct inode *inode)
+{
+  disk_sector_t prev = 0;
+  int fragment_cnt = 0;
+  off_t ofs;
+
+  for (ofs = 0; ofs < inode_length (inode); ofs += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = inode_get_sector (inode, ofs);
+      if (sector == 0)
+        continue;
+      if (fragment_cnt == 0 || sector != prev + 1)
+        fragment_cnt++;
+      prev = sector;
+    }
+  return fragment_cnt;
+}
+
+/* Prints how many fragments each file in the root directory is
+   split into, and the average over all files. */
+void
+fsutil_layout (char **argv UNUSED)
+{
+  struct dir *dir;
+  char name[NAME_MAX + 1];
+  int file_cnt = 0;
+  int fragment_cnt = 0;
+
+  printf ("Layout of files in the root directory:\n");
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  while (dir_readdir (dir, name))
+    {
+      struct inode *inode;
+      int n;
+
+      if (!dir_lookup (dir, name, &inode))
+        continue;
+      n = count_fragments (inode);
+      printf ("%s: %"PROTd" bytes in %d fragments\n",
+              name, inode_length (inode), n);
+      inode_close (inode);
+      file_cnt++;
+      fragment_cnt += n;
+    }
+  dir_close (dir);
+
+  if (file_cnt > 0)
+    printf ("Average: %d.%02d fragments per file\n",
+            fragment_cnt / file_cnt, fragment_cnt * 100 / file_cnt % 100);
+  printf ("End of layout.\n");
+}
+
+/* Moves the data of each file in the root directory into one run
+   of consecutive sectors, where a free run is long enough, and
+   prints how many fragments each file was split into before and
+   after. */
+void
+fsutil_defrag (char **argv UNUSED)
+{
+  struct dir *dir;
+  char name[NAME_MAX + 1];
+  int file_cnt = 0;
+  int before_cnt = 0;
+  int after_cnt = 0;
+
+  printf ("Defragmenting files in the root directory:\n");
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  while (dir_readdir (dir, name))
+    {
+      struct inode *inode;
+      int before, after;
+
+      if (!dir_lookup (dir, name, &inode))
+        continue;
+      before = count_fragments (inode);
+      if (before > 1 && !inode_defragment (inode))
+        printf ("%s: not enough contiguous free space\n", name);
+      after = count_fragments (inode);
+      printf ("%s: %d fragments before, %d after\n", name, before, after);
+      inode_close (inode);
+      file_cnt++;
+      before_cnt += before;
+      after_cnt += after;
+    }
+  dir_close (dir);
+  journal_commit ();
+
+  if (file_cnt > 0)
+    printf ("Average: %d.%02d fragments per file before, %d.%02d after\n",
+            before_cnt / file_cnt, before_cnt * 100 / file_cnt % 100,
+            after_cnt / file_cnt, after_cnt * 100 / file_cnt % 100);
+  printf ("End of defragmentation.\n");
 }
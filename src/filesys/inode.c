@@ -1,79 +1,246 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Identifies an inode, and which way it maps file offsets to
+   sectors.  A small file keeps its data in the inode itself until
+   it grows too big, and then switches to the map its magic
+   names. */
+#define INODE_MAGIC 0x494e4f44          /* Block map. */
+#define EXTENT_MAGIC 0x494e4f58         /* Extent map. */
+#define INLINE_MAGIC 0x494e4f49         /* Inline, then block map. */
+#define INLINE_EXTENT_MAGIC 0x494e4f4a  /* Inline, then extent map. */
+
+/* Sectors are allocated in file system blocks of `block_sectors'
+   sectors.  A data block holds that many consecutive sectors of a
+   file; an inode, index or leaf block uses only its first. */
+#define BLOCK_SECTORS ((off_t) block_sectors)
+
+/* Block map format.
+
+   Number of block pointers in an inode: direct pointers to data
+   blocks, then one pointer to an indirect block of data block
+   pointers, then one to a doubly indirect block of indirect block
+   pointers.  A pointer is the first sector of the block it points
+   to.  A zero pointer is a block not yet allocated; sector 0
+   holds the free map's inode, so no data block is ever at 0. */
+#define DIRECT_CNT 123
+#define INDIRECT_CNT 1
+#define DBL_INDIRECT_CNT 1
+#define SECTOR_CNT (DIRECT_CNT + INDIRECT_CNT + DBL_INDIRECT_CNT)
+
+/* Number of block pointers in an indirect block. */
+#define PTRS_PER_SECTOR ((off_t) (DISK_SECTOR_SIZE / sizeof (disk_sector_t)))
+
+/* Maximum file size in the block map format, in bytes. */
+#define INODE_SPAN ((DIRECT_CNT                                              \
+                     + PTRS_PER_SECTOR * INDIRECT_CNT                        \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR * DBL_INDIRECT_CNT) \
+                    * BLOCK_SECTORS * DISK_SECTOR_SIZE)
+
+/* Extent map format.
+
+   A file's data is a list of runs of consecutive sectors that
+   together cover its first `sector_cnt' sectors, in file order.
+   The first few extents are kept in the inode.  Further extents
+   go in leaf blocks, which are found through a single index
+   block that also records how many sectors each leaf covers, so
+   that a lookup reads at most two sectors beyond the inode.  An
+   extent that starts at sector 0 is a hole: its sectors are not
+   allocated and read as zeros until written, as does file data
+   past `sector_cnt' sectors.  Sector 0 holds the free map's
+   inode, so it never starts an extent of data.  Extents, holes
+   and `sector_cnt' all cover whole blocks. */
+
+/* LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    disk_sector_t start;                /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Entry in an extent index block. */
+struct extent_leaf
+  {
+    uint32_t sector_cnt;                /* Sectors covered by leaf. */
+    disk_sector_t sector;               /* Leaf block sector. */
+  };
+
+#define INLINE_EXTENT_CNT 61
+#define LEAF_EXTENT_CNT ((off_t) (DISK_SECTOR_SIZE / sizeof (struct extent)))
+#define LEAF_CNT ((off_t) (DISK_SECTOR_SIZE / sizeof (struct extent_leaf)))
+
+/* Leaves an extent map may use.  Filling a hole shifts every
+   extent after it, so this bounds the blocks one write can add
+   to the journal, which must fit a transaction alongside other
+   operations'. */
+#define LEAF_MAX 8
+
+/* Extents of an inode, as stored in its sector. */
+struct extent_map
+  {
+    struct extent extents[INLINE_EXTENT_CNT]; /* First extents. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    uint32_t sector_cnt;                /* Sectors covered by extents. */
+    disk_sector_t index;                /* Index block, or 0. */
+  };
+
+/* Maximum size of a file whose data is kept in its inode. */
+#define INLINE_SIZE ((off_t) (SECTOR_CNT * sizeof (disk_sector_t)))
 
 /* On-disk inode.
    Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    disk_sector_t start;                /* First data sector. */
+    union
+      {
+        disk_sector_t sectors[SECTOR_CNT];  /* Block map. */
+        struct extent_map extents;          /* Extent map. */
+        uint8_t bytes[INLINE_SIZE];         /* Inline data. */
+      }
+    map;
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    disk_sector_t dir_index;            /* Directory hash index, or 0. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
-}
-
 /* In-memory inode. */
-struct inode 
+struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in `inodes'. */
+    struct list_elem lru_elem;          /* Element in `closed_inodes'. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Is `data' being read? */
+    struct condition loaded;            /* Signaled when `data' is read. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool journaled;                     /* Is the data metadata too? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Serializes allocation, growth. */
+    struct rwlock map_lock;             /* Excludes readers of the map. */
+    struct lock dir_lock;               /* Serializes directory changes. */
+    disk_sector_t alloc_goal;           /* Where to look for free sectors. */
+    int access_cnt;                     /* Reads and writes under way. */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the disk sector that contains byte offset POS within
-   INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
-{
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / DISK_SECTOR_SIZE;
-  else
-    return -1;
-}
+/* Format of newly created inodes. */
+enum inode_format inode_format;
+
+/* Count reads and writes that overlap others on the same inode?
+   Set by the kernel command-line option "-overlaps". */
+bool inode_count_overlaps;
+
+/* Inode cache.
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+   Open inodes are kept in a hash table keyed by sector, so that
+   opening a single inode twice returns the same `struct inode'.
+   When the last opener closes an inode, it stays in the table,
+   and on the CLOSED_INODE_CNT-long list of closed inodes, so that
+   reopening it soon does not reread its sector; the least
+   recently closed one is freed when the list overflows.
+   INODES_LOCK protects the table, the list, and each inode's
+   `open_cnt' and `loading'.  It is not held while an inode's
+   sector is read: the inode goes into the table marked
+   `loading', and others who open it meanwhile wait on its
+   `loaded' condition. */
+#define CLOSED_INODE_CNT 32
+static struct hash inodes;
+static struct list closed_inodes;
+static struct lock inodes_lock;
+
+/* Statistics. */
+static long long index_read_cnt;        /* Index sectors read. */
+static long long open_hit_cnt;          /* Opens found in the cache. */
+static long long open_miss_cnt;         /* Opens that read the inode. */
+static long long read_overlap_cnt;      /* Reads that overlapped others. */
+static long long write_overlap_cnt;     /* Writes that overlapped others. */
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
-inode_init (void) 
+inode_init (void)
+{
+  hash_init (&inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  lock_init (&inodes_lock);
+}
+
+/* Returns true if INODE keeps its data in the inode itself. */
+static inline bool
+is_inline (const struct inode *inode)
+{
+  return (inode->data.magic == INLINE_MAGIC
+          || inode->data.magic == INLINE_EXTENT_MAGIC);
+}
+
+/* Returns true if INODE uses the extent map format, or will once
+   its data no longer fits in the inode. */
+static inline bool
+uses_extents (const struct inode *inode)
+{
+  return (inode->data.magic == EXTENT_MAGIC
+          || inode->data.magic == INLINE_EXTENT_MAGIC);
+}
+
+/* Marks BLOCK, which the caller has locked exclusively and which
+   holds metadata, dirty as part of the running journal
+   transaction. */
+static void
+dirty_metadata (struct cache_block *block)
+{
+  cache_dirty (block);
+  journal_add (block);
+}
+
+/* Marks BLOCK, which the caller has locked exclusively and which
+   holds data of INODE, dirty, journaling it if INODE's data is
+   metadata. */
+static void
+dirty_data (struct inode *inode, struct cache_block *block)
+{
+  cache_dirty (block);
+  if (inode->journaled)
+    journal_add (block);
+}
+
+/* Writes INODE's in-memory copy of its on-disk inode back to its
+   sector.  The caller must hold no cache blocks. */
+static void
+inode_write_disk (struct inode *inode)
 {
-  list_init (&open_inodes);
+  struct cache_block *block = cache_lock (inode->sector, EXCLUSIVE);
+  memcpy (cache_zero (block), &inode->data, DISK_SECTOR_SIZE);
+  journal_add (block);
+  cache_unlock (block);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   disk.
+   disk.  The inode uses the format in `inode_format'.  Data
+   sectors are allocated as they are written, so the file reads
+   as all zeros until then.  A file of at most INLINE_SIZE bytes
+   starts out with its data in the inode.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
 inode_create (disk_sector_t sector, off_t length)
 {
-  struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct cache_block *block;
+  struct inode_disk *disk_inode;
 
   ASSERT (length >= 0);
 
@@ -81,63 +248,86 @@ inode_create (disk_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
-        {
-          disk_write (filesys_disk, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[DISK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                disk_write (filesys_disk, disk_inode->start + i, zeros); 
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
-  return success;
+  if (inode_format == INODE_BLOCKS && length > INODE_SPAN)
+    return false;
+
+  block = cache_lock (sector, EXCLUSIVE);
+  disk_inode = cache_zero (block);
+  disk_inode->length = length;
+  if (length <= INLINE_SIZE)
+    disk_inode->magic = (inode_format == INODE_EXTENTS
+                         ? INLINE_EXTENT_MAGIC : INLINE_MAGIC);
+  else
+    disk_inode->magic = (inode_format == INODE_EXTENTS
+                         ? EXTENT_MAGIC : INODE_MAGIC);
+  journal_add (block);
+  cache_unlock (block);
+  return true;
 }
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
-inode_open (disk_sector_t sector) 
+inode_open (disk_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
+  struct cache_block *block;
+
+  lock_acquire (&inodes_lock);
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open or recently
+     closed. */
+  key.sector = sector;
+  e = hash_find (&inodes, &key.hash_elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt++ == 0)
+        list_remove (&inode->lru_elem);
+      open_hit_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &inodes_lock);
+      lock_release (&inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&inodes, &inode->hash_elem);
   inode->open_cnt = 1;
+  inode->loading = true;
+  cond_init (&inode->loaded);
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  disk_read (filesys_disk, inode->sector, &inode->data);
+  inode->journaled = false;
+  lock_init (&inode->lock);
+  rwlock_init (&inode->map_lock);
+  lock_init (&inode->dir_lock);
+  inode->alloc_goal = sector + 1;
+  inode->access_cnt = 0;
+  open_miss_cnt++;
+  lock_release (&inodes_lock);
+
+  /* Read the inode without holding INODES_LOCK. */
+  block = cache_lock (inode->sector, NON_EXCLUSIVE);
+  memcpy (&inode->data, cache_read (block), DISK_SECTOR_SIZE);
+  cache_unlock (block);
+
+  lock_acquire (&inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &inodes_lock);
+  lock_release (&inodes_lock);
   return inode;
 }
 
@@ -145,10 +335,12 @@ inode_open (disk_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  if (inode != NULL) 
+  if (inode != NULL)
     {
+      lock_acquire (&inodes_lock);
       ASSERT(inode->open_cnt != 0);
       inode->open_cnt++;
+      lock_release (&inodes_lock);
     }
   return inode;
 }
@@ -160,58 +352,963 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns the format of INODE. */
+enum inode_format
+inode_get_format (const struct inode *inode)
+{
+  return uses_extents (inode) ? INODE_EXTENTS : INODE_BLOCKS;
+}
+
+/* Returns the sector of the hash index inode of directory INODE,
+   or 0 if it has none. */
+disk_sector_t
+inode_get_dir_index (const struct inode *inode)
+{
+  return inode->data.dir_index;
+}
+
+/* Acquires the lock that serializes operations on directory
+   INODE's entries. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock acquired by inode_lock_dir(). */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Records SECTOR as the hash index inode of directory INODE. */
+void
+inode_set_dir_index (struct inode *inode, disk_sector_t sector)
+{
+  journal_begin (JOURNAL_OP_BLOCKS);
+  lock_acquire (&inode->lock);
+  inode->data.dir_index = sector;
+  inode_write_disk (inode);
+  lock_release (&inode->lock);
+  journal_end ();
+}
+
+/* Marks INODE's data as file system metadata, such as a
+   directory's entries or the free map, so that writes to it are
+   journaled along with the inode's own changes. */
+void
+inode_journal_data (struct inode *inode)
+{
+  inode->journaled = true;
+}
+
+/* Releases the CNT sectors starting at SECTOR, discarding any
+   cached copies. */
+static void
+release_sectors (disk_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    cache_free (sector + i);
+  free_map_release (sector, cnt);
+}
+
+/* Releases the block at SECTOR and, if it is an indirect block of
+   the given LEVEL (1 for indirect, 2 for doubly indirect), every
+   block it points to. */
+static void
+deallocate_recursive (disk_sector_t sector, int level)
+{
+  if (level > 0)
+    {
+      struct cache_block *block = cache_lock (sector, NON_EXCLUSIVE);
+      disk_sector_t ptrs[PTRS_PER_SECTOR];
+      off_t i;
+
+      memcpy (ptrs, cache_read (block), sizeof ptrs);
+      cache_unlock (block);
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        if (ptrs[i] != 0)
+          deallocate_recursive (ptrs[i], level - 1);
+    }
+  release_sectors (sector, level > 0 ? 1 : block_sectors);
+}
+
+/* Releases the data and index sectors of block-mapped INODE. */
+static void
+deallocate_blocks (const struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < SECTOR_CNT; i++)
+    if (inode->data.map.sectors[i] != 0)
+      {
+        int level = (i < DIRECT_CNT ? 0
+                     : i < DIRECT_CNT + INDIRECT_CNT ? 1
+                     : 2);
+        deallocate_recursive (inode->data.map.sectors[i], level);
+      }
+}
+
+/* Releases the data, leaf and index sectors of extent-mapped
+   INODE. */
+static void
+deallocate_extents (const struct inode *inode)
+{
+  const struct extent_map *map = &inode->data.map.extents;
+  off_t extent_cnt = map->extent_cnt;
+  off_t i;
+
+  for (i = 0; i < extent_cnt && i < INLINE_EXTENT_CNT; i++)
+    if (map->extents[i].start != 0)
+      release_sectors (map->extents[i].start, map->extents[i].length);
+
+  if (map->index != 0)
+    {
+      struct extent_leaf leaves[LEAF_CNT];
+      struct cache_block *block;
+      off_t j;
+
+      block = cache_lock (map->index, NON_EXCLUSIVE);
+      memcpy (leaves, cache_read (block), sizeof leaves);
+      cache_unlock (block);
+
+      for (j = 0; j < LEAF_CNT && leaves[j].sector != 0; j++)
+        {
+          struct extent extents[LEAF_EXTENT_CNT];
+          off_t k;
+
+          block = cache_lock (leaves[j].sector, NON_EXCLUSIVE);
+          memcpy (extents, cache_read (block), sizeof extents);
+          cache_unlock (block);
+
+          for (k = 0; k < LEAF_EXTENT_CNT && i < extent_cnt; k++, i++)
+            if (extents[k].start != 0)
+              release_sectors (extents[k].start, extents[k].length);
+          release_sectors (leaves[j].sector, 1);
+        }
+      release_sectors (map->index, 1);
+    }
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void
-inode_close (struct inode *inode) 
+inode_close (struct inode *inode)
 {
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&inodes_lock);
+  if (--inode->open_cnt > 0)
+    inode = NULL;
+  else if (!inode->removed)
+    {
+      /* Keep INODE around in case it is reopened, making room
+         by freeing the least recently closed inode. */
+      list_push_front (&closed_inodes, &inode->lru_elem);
+      if (list_size (&closed_inodes) > CLOSED_INODE_CNT)
+        {
+          struct list_elem *e = list_pop_back (&closed_inodes);
+          inode = list_entry (e, struct inode, lru_elem);
+          hash_delete (&inodes, &inode->hash_elem);
+        }
+      else
+        inode = NULL;
+    }
+  else
+    hash_delete (&inodes, &inode->hash_elem);
+  lock_release (&inodes_lock);
+
+  if (inode != NULL)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      if (inode->removed)
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin (JOURNAL_OP_BLOCKS);
+          if (inode->data.dir_index != 0)
+            {
+              struct inode *index = inode_open (inode->data.dir_index);
+              if (index != NULL)
+                {
+                  inode_remove (index);
+                  inode_close (index);
+                }
+            }
+          if (!is_inline (inode))
+            {
+              if (uses_extents (inode))
+                deallocate_extents (inode);
+              else
+                deallocate_blocks (inode);
+            }
+          release_sectors (inode->sector, 1);
+          free_map_sync ();
+          journal_end ();
         }
 
-      free (inode); 
+      free (inode);
     }
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
-inode_remove (struct inode *inode) 
+inode_remove (struct inode *inode)
 {
   ASSERT (inode != NULL);
   inode->removed = true;
 }
 
+/* Fills SECTOR with zeros in the cache. */
+static void
+zero_sector (disk_sector_t sector)
+{
+  struct cache_block *block = cache_lock (sector, EXCLUSIVE);
+  cache_zero (block);
+  cache_unlock (block);
+}
+
+/* Allocates a block for INODE, close to the block it allocated
+   last, and stores its first sector into *SECTORP.  If ZERO is
+   true, also fills that sector with zeros.
+   Returns true if successful, false if the disk is full. */
+static bool
+allocate_sector (struct inode *inode, disk_sector_t *sectorp, bool zero)
+{
+  if (!free_map_allocate (1, inode->alloc_goal, sectorp))
+    return false;
+  inode->alloc_goal = *sectorp + block_sectors;
+  if (zero)
+    zero_sector (*sectorp);
+  return true;
+}
+
+/* Returns true if newly allocated sector SECTOR_IDX within INODE
+   must be zeroed before a write of SIZE bytes at OFFSET, that is,
+   unless the write covers the whole sector and the sector lies
+   entirely past end of file, where no reader can see it before
+   the write is done. */
+static bool
+needs_zero (const struct inode *inode, off_t sector_idx,
+            off_t offset, off_t size)
+{
+  off_t start = sector_idx * DISK_SECTOR_SIZE;
+  return !(start >= offset
+           && start + DISK_SECTOR_SIZE <= offset + size
+           && start >= inode_length (inode));
+}
+
+/* Zeros those of the CNT newly allocated sectors starting at
+   START, which hold data sectors FIRST_IDX onward of INODE, that
+   needs_zero() says must be, for a write of SIZE bytes at
+   OFFSET. */
+static void
+zero_run (const struct inode *inode, disk_sector_t start, off_t first_idx,
+          off_t cnt, off_t offset, off_t size)
+{
+  off_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (needs_zero (inode, first_idx + i, offset, size))
+      zero_sector (start + i);
+}
+
+/* Translates block index BLOCK_IDX within a file into the path
+   of pointers that leads to it: OFFSETS[0] indexes the inode's
+   `sectors', OFFSETS[1] the block that points to, and so on.
+   Stores the number of levels into *OFFSET_CNT. */
+static void
+calculate_indices (off_t sector_idx, size_t offsets[], size_t *offset_cnt)
+{
+  /* Handle direct blocks. */
+  if (sector_idx < DIRECT_CNT)
+    {
+      offsets[0] = sector_idx;
+      *offset_cnt = 1;
+      return;
+    }
+  sector_idx -= DIRECT_CNT;
+
+  /* Handle indirect blocks. */
+  if (sector_idx < PTRS_PER_SECTOR * INDIRECT_CNT)
+    {
+      offsets[0] = DIRECT_CNT + sector_idx / PTRS_PER_SECTOR;
+      offsets[1] = sector_idx % PTRS_PER_SECTOR;
+      *offset_cnt = 2;
+      return;
+    }
+  sector_idx -= PTRS_PER_SECTOR * INDIRECT_CNT;
+
+  /* Handle doubly indirect blocks. */
+  if (sector_idx < DBL_INDIRECT_CNT * PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      offsets[0] = (DIRECT_CNT + INDIRECT_CNT
+                    + sector_idx / (PTRS_PER_SECTOR * PTRS_PER_SECTOR));
+      offsets[1] = sector_idx / PTRS_PER_SECTOR % PTRS_PER_SECTOR;
+      offsets[2] = sector_idx % PTRS_PER_SECTOR;
+      *offset_cnt = 3;
+      return;
+    }
+  NOT_REACHED ();
+}
+
+/* Stores into *SECTORP data sector SECTOR_IDX of block-mapped
+   INODE, or 0 if the block that holds it has not been allocated.
+   If ALLOCATE is true, the data block and any index blocks on
+   the way to it are allocated if necessary, for a write of SIZE
+   bytes at OFFSET; the caller must hold INODE's lock.  New index
+   blocks are zeroed before they are linked in, and so are the
+   sectors of a new data block that needs_zero() picks.
+   Returns true if successful, false if allocation fails. */
+static bool
+blocks_get_sector (struct inode *inode, off_t sector_idx, bool allocate,
+                   off_t offset, off_t size, disk_sector_t *sectorp)
+{
+  off_t first_idx = ROUND_DOWN (sector_idx, BLOCK_SECTORS);
+  size_t offsets[3];
+  size_t offset_cnt;
+  disk_sector_t sector;
+  size_t level;
+
+  ASSERT (!allocate || lock_held_by_current_thread (&inode->lock));
+
+  calculate_indices (sector_idx / BLOCK_SECTORS, offsets, &offset_cnt);
+
+  /* First level is in the inode itself. */
+  sector = inode->data.map.sectors[offsets[0]];
+  if (sector == 0 && allocate)
+    {
+      if (!allocate_sector (inode, &sector, offset_cnt > 1))
+        return false;
+      if (offset_cnt == 1)
+        zero_run (inode, sector, first_idx, BLOCK_SECTORS, offset, size);
+      inode->data.map.sectors[offsets[0]] = sector;
+      inode_write_disk (inode);
+    }
+
+  /* Deeper levels are in indirect blocks. */
+  for (level = 1; level < offset_cnt && sector != 0; level++)
+    {
+      struct cache_block *block = cache_lock (sector, NON_EXCLUSIVE);
+      disk_sector_t next = ((disk_sector_t *) cache_read (block))
+                           [offsets[level]];
+      cache_unlock (block);
+      index_read_cnt++;
+
+      if (next == 0 && allocate)
+        {
+          /* Only holders of INODE's lock change INODE's index
+             blocks, so the slot is still empty once we have the
+             block exclusively. */
+          if (!allocate_sector (inode, &next, level + 1 < offset_cnt))
+            return false;
+          if (level + 1 == offset_cnt)
+            zero_run (inode, next, first_idx, BLOCK_SECTORS, offset, size);
+          block = cache_lock (sector, EXCLUSIVE);
+          ((disk_sector_t *) cache_read (block))[offsets[level]] = next;
+          dirty_metadata (block);
+          cache_unlock (block);
+        }
+      sector = next;
+    }
+
+  *sectorp = sector != 0 ? sector + sector_idx % BLOCK_SECTORS : 0;
+  return true;
+}
+
+/* Allocates the blocks of block-mapped INODE needed for a write
+   of SIZE bytes at OFFSET.  The caller must hold INODE's lock.
+   Returns true if successful, false if the disk filled up, in
+   which case only some of the blocks may have been allocated. */
+static bool
+blocks_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  off_t sector_idx;
+
+  for (sector_idx = ROUND_DOWN (offset / DISK_SECTOR_SIZE, BLOCK_SECTORS);
+       sector_idx < DIV_ROUND_UP (offset + size, DISK_SECTOR_SIZE);
+       sector_idx += BLOCK_SECTORS)
+    {
+      disk_sector_t sector;
+      if (!blocks_get_sector (inode, sector_idx, true, offset, size, &sector))
+        return false;
+    }
+  return true;
+}
+
+/* Finds the extent of extent-mapped INODE that covers data
+   sector SECTOR_IDX, which must be less than the number of
+   sectors its extents cover.  Stores the extent into *E, its
+   position in the extent list into *IDX, and the number of
+   sectors covered by the extents before it into *BASE. */
+static void
+locate_extent (struct inode *inode, off_t sector_idx,
+               struct extent *e, off_t *idx, off_t *base)
+{
+  const struct extent_map *map = &inode->data.map.extents;
+  struct cache_block *block;
+  const struct extent_leaf *leaves;
+  const struct extent *extents;
+  disk_sector_t leaf_sector = 0;
+  off_t i, j;
+
+  ASSERT (sector_idx < (off_t) map->sector_cnt);
+
+  /* Search the extents in the inode. */
+  *base = 0;
+  for (i = 0; i < (off_t) map->extent_cnt && i < INLINE_EXTENT_CNT; i++)
+    {
+      if (sector_idx < *base + (off_t) map->extents[i].length)
+        {
+          *e = map->extents[i];
+          *idx = i;
+          return;
+        }
+      *base += map->extents[i].length;
+    }
+
+  /* Find the leaf that covers SECTOR_IDX. */
+  block = cache_lock (map->index, NON_EXCLUSIVE);
+  index_read_cnt++;
+  leaves = cache_read (block);
+  for (j = 0; j < LEAF_CNT; j++)
+    {
+      if (sector_idx < *base + (off_t) leaves[j].sector_cnt)
+        {
+          leaf_sector = leaves[j].sector;
+          break;
+        }
+      *base += leaves[j].sector_cnt;
+    }
+  cache_unlock (block);
+  ASSERT (leaf_sector != 0);
+
+  /* Search the leaf. */
+  block = cache_lock (leaf_sector, NON_EXCLUSIVE);
+  index_read_cnt++;
+  extents = cache_read (block);
+  for (i = 0; sector_idx >= *base + (off_t) extents[i].length; i++)
+    {
+      *base += extents[i].length;
+      ASSERT (i + 1 < LEAF_EXTENT_CNT);
+    }
+  *e = extents[i];
+  *idx = INLINE_EXTENT_CNT + j * LEAF_EXTENT_CNT + i;
+  cache_unlock (block);
+}
+
+/* Returns data sector SECTOR_IDX of extent-mapped INODE, or 0 if
+   that sector has not been allocated. */
+static disk_sector_t
+extents_get_sector (struct inode *inode, off_t sector_idx)
+{
+  struct extent e;
+  off_t idx, base;
+
+  if (sector_idx >= (off_t) inode->data.map.extents.sector_cnt)
+    return 0;
+
+  rwlock_acquire_read (&inode->map_lock);
+  locate_extent (inode, sector_idx, &e, &idx, &base);
+  rwlock_release_read (&inode->map_lock);
+  return e.start != 0 ? e.start + (sector_idx - base) : 0;
+}
+
+/* Returns the sector of the leaf block that holds extent IDX of
+   extent-mapped INODE, which must have been reserved. */
+static disk_sector_t
+leaf_sector (struct inode *inode, off_t idx)
+{
+  struct cache_block *block;
+  disk_sector_t sector;
+
+  block = cache_lock (inode->data.map.extents.index, NON_EXCLUSIVE);
+  sector = ((struct extent_leaf *) cache_read (block))
+           [(idx - INLINE_EXTENT_CNT) / LEAF_EXTENT_CNT].sector;
+  cache_unlock (block);
+  return sector;
+}
+
+/* Returns extent IDX of extent-mapped INODE.  An extent slot that
+   has never been used is all zeros. */
+static struct extent
+get_extent (struct inode *inode, off_t idx)
+{
+  struct cache_block *block;
+  struct extent e;
+
+  if (idx < INLINE_EXTENT_CNT)
+    return inode->data.map.extents.extents[idx];
+
+  block = cache_lock (leaf_sector (inode, idx), NON_EXCLUSIVE);
+  e = ((struct extent *) cache_read (block))
+      [(idx - INLINE_EXTENT_CNT) % LEAF_EXTENT_CNT];
+  cache_unlock (block);
+  return e;
+}
+
+/* Sets extent IDX of extent-mapped INODE to E, keeping the count
+   of sectors covered by its leaf up to date.  The slot must have
+   been reserved.  Extents in the inode itself only change in
+   memory; the caller must write INODE to disk. */
+static void
+set_extent (struct inode *inode, off_t idx, struct extent e)
+{
+  struct cache_block *block;
+  struct extent_leaf *leaves;
+  struct extent *slot;
+  off_t j = (idx - INLINE_EXTENT_CNT) / LEAF_EXTENT_CNT;
+  uint32_t old_length;
+
+  if (idx < INLINE_EXTENT_CNT)
+    {
+      inode->data.map.extents.extents[idx] = e;
+      return;
+    }
+
+  /* Update the leaf... */
+  block = cache_lock (leaf_sector (inode, idx), EXCLUSIVE);
+  slot = (struct extent *) cache_read (block)
+         + (idx - INLINE_EXTENT_CNT) % LEAF_EXTENT_CNT;
+  old_length = slot->length;
+  *slot = e;
+  dirty_metadata (block);
+  cache_unlock (block);
+
+  /* ...and the number of sectors it covers in the index. */
+  block = cache_lock (inode->data.map.extents.index, EXCLUSIVE);
+  leaves = cache_read (block);
+  leaves[j].sector_cnt += e.length - old_length;
+  dirty_metadata (block);
+  cache_unlock (block);
+}
+
+/* Allocates the index and leaf blocks that extent-mapped INODE
+   needs to hold EXTENT_CNT extents.  The caller must hold INODE's
+   lock.
+   Returns true if successful, false if the disk is full or
+   INODE cannot hold that many extents. */
+static bool
+reserve_extents (struct inode *inode, off_t extent_cnt)
+{
+  struct extent_map *map = &inode->data.map.extents;
+  off_t j;
+
+  if (extent_cnt > INLINE_EXTENT_CNT + LEAF_MAX * LEAF_EXTENT_CNT)
+    return false;
+  if (extent_cnt <= INLINE_EXTENT_CNT)
+    return true;
+
+  if (map->index == 0)
+    {
+      if (!allocate_sector (inode, &map->index, true))
+        return false;
+      inode_write_disk (inode);
+    }
+  for (j = 0; j <= (extent_cnt - 1 - INLINE_EXTENT_CNT) / LEAF_EXTENT_CNT; j++)
+    if (leaf_sector (inode, INLINE_EXTENT_CNT + j * LEAF_EXTENT_CNT) == 0)
+      {
+        struct cache_block *block;
+        disk_sector_t sector;
+
+        if (!allocate_sector (inode, &sector, true))
+          return false;
+        block = cache_lock (map->index, EXCLUSIVE);
+        ((struct extent_leaf *) cache_read (block))[j].sector = sector;
+        dirty_metadata (block);
+        cache_unlock (block);
+      }
+  return true;
+}
+
+/* Adds the CNT sectors starting at START to the end of
+   extent-mapped INODE, by lengthening its last extent if START
+   follows it, otherwise as a new extent.  If START is 0, the
+   sectors are a hole.  The caller must hold INODE's lock.
+   Readers may look up sectors meanwhile, because the sectors
+   added only become visible once the map's sector count grows.
+   Returns true if successful, false if INODE has no room for
+   another extent. */
+static bool
+extents_append (struct inode *inode, disk_sector_t start, size_t cnt)
+{
+  struct extent_map *map = &inode->data.map.extents;
+  off_t last = (off_t) map->extent_cnt - 1;
+  struct extent e;
+
+  e = last >= 0 ? get_extent (inode, last) : (struct extent) {0, 0};
+  if (last >= 0
+      && (start == 0
+          ? e.start == 0
+          : e.start != 0 && e.start + e.length == start))
+    {
+      e.length += cnt;
+      set_extent (inode, last, e);
+    }
+  else
+    {
+      if (!reserve_extents (inode, last + 2))
+        return false;
+      e.start = start;
+      e.length = cnt;
+      set_extent (inode, last + 1, e);
+      map->extent_cnt++;
+    }
+
+  map->sector_cnt += cnt;
+  inode_write_disk (inode);
+  return true;
+}
+
+/* Replaces the OLD_CNT extents of extent-mapped INODE starting
+   at IDX by the NEW_CNT extents in NEW, which together cover the
+   same sectors, shifting the extents after them.  The caller must
+   hold INODE's lock.
+   Returns true if successful, false if the disk or the extent
+   map filled up, in which case INODE is unchanged. */
+static bool
+extents_replace (struct inode *inode, off_t idx, off_t old_cnt,
+                 const struct extent new[], off_t new_cnt)
+{
+  struct extent_map *map = &inode->data.map.extents;
+  off_t old_extent_cnt = map->extent_cnt;
+  off_t shift = new_cnt - old_cnt;
+  off_t i;
+
+  if (!reserve_extents (inode, old_extent_cnt + shift))
+    return false;
+
+  /* Readers could see extents in the middle of being shifted, so
+     keep them out.  Slots that fall out of use are cleared. */
+  rwlock_acquire_write (&inode->map_lock);
+  if (shift > 0)
+    for (i = old_extent_cnt + shift - 1; i >= idx + new_cnt; i--)
+      set_extent (inode, i, get_extent (inode, i - shift));
+  else if (shift < 0)
+    {
+      for (i = idx + new_cnt; i < old_extent_cnt + shift; i++)
+        set_extent (inode, i, get_extent (inode, i - shift));
+      for (; i < old_extent_cnt; i++)
+        set_extent (inode, i, (struct extent) {0, 0});
+    }
+  for (i = 0; i < new_cnt; i++)
+    set_extent (inode, idx + i, new[i]);
+  map->extent_cnt = old_extent_cnt + shift;
+  rwlock_release_write (&inode->map_lock);
+
+  inode_write_disk (inode);
+  return true;
+}
+
+/* Allocates a run of up to CNT free sectors, a whole number of
+   blocks, for INODE near GOAL, settling for fewer blocks if no
+   run that long is free, and stores its first sector into *START
+   and its length into *CNT.
+   Returns true if successful, false if the disk is full. */
+static bool
+allocate_run (disk_sector_t goal, disk_sector_t *start, size_t *cnt)
+{
+  while (!free_map_allocate (*cnt, goal, start))
+    {
+      if (*cnt <= block_sectors)
+        return false;
+      *cnt = ROUND_UP (*cnt / 2, block_sectors);
+    }
+  return true;
+}
+
+/* Allocates sectors for the holes in extent-mapped INODE between
+   sectors FROM and TO, which must be within the sectors its
+   extents cover, for a write of SIZE bytes at OFFSET.  Each hole
+   extent is split around the sectors allocated, which join the
+   data extents on either side when they are contiguous with them,
+   so that filling a hole in order does not leave one extent per
+   write.  The caller must hold INODE's lock.
+   Returns true if successful, false if the disk or the extent
+   map filled up. */
+static bool
+extents_fill (struct inode *inode, off_t from, off_t to,
+              off_t offset, off_t size)
+{
+  while (from < to)
+    {
+      struct extent e, run, new[3];
+      off_t idx, base, end;
+      off_t first, old_cnt;
+      disk_sector_t goal, start;
+      size_t cnt;
+      int new_cnt = 0;
+
+      locate_extent (inode, from, &e, &idx, &base);
+      end = base + (off_t) e.length;
+      if (end > to)
+        end = to;
+      if (e.start != 0)
+        {
+          from = end;
+          continue;
+        }
+
+      /* Allocate sectors for the part of the hole the write
+         covers, near the data before it. */
+      goal = from > 0 ? extents_get_sector (inode, from - 1) : 0;
+      goal = goal != 0 ? goal + 1 : inode->sector + 1;
+      cnt = end - from;
+      if (!allocate_run (goal, &start, &cnt))
+        return false;
+      zero_run (inode, start, from, cnt, offset, size);
+
+      /* Split the hole around them, joining them to the extents
+         before and after the hole if possible. */
+      first = idx;
+      old_cnt = 1;
+      run = (struct extent) {start, cnt};
+      if (from > base)
+        new[new_cnt++] = (struct extent) {0, from - base};
+      else if (idx > 0)
+        {
+          struct extent prev = get_extent (inode, idx - 1);
+          if (prev.start != 0 && prev.start + prev.length == start)
+            {
+              first--;
+              old_cnt++;
+              run.start = prev.start;
+              run.length += prev.length;
+            }
+        }
+      new[new_cnt++] = run;
+      if (from + (off_t) cnt < base + (off_t) e.length)
+        new[new_cnt++] = (struct extent) {0, base + e.length - (from + cnt)};
+      else if (idx + 1 < (off_t) inode->data.map.extents.extent_cnt)
+        {
+          struct extent next = get_extent (inode, idx + 1);
+          if (next.start != 0 && start + cnt == next.start)
+            {
+              old_cnt++;
+              new[new_cnt - 1].length += next.length;
+            }
+        }
+      if (!extents_replace (inode, first, old_cnt, new, new_cnt))
+        {
+          release_sectors (start, cnt);
+          return false;
+        }
+      from += cnt;
+    }
+  return true;
+}
+
+/* Allocates the sectors of extent-mapped INODE needed for a
+   write of SIZE bytes at OFFSET.  Sectors between the end of the
+   file's extents and the write are recorded as a hole rather than
+   allocated.  Holes that the write covers are filled in, then
+   sectors past the end of the extents are added, trying to extend
+   the file's last extent first, then to find a free run large
+   enough for the rest of the write, then settling for smaller
+   runs.  The caller must hold INODE's lock.
+   Returns true if successful, false if the disk or the extent
+   map filled up, in which case only some of the sectors may have
+   been allocated. */
+static bool
+extents_allocate (struct inode *inode, off_t offset, off_t size)
+{
+  struct extent_map *map = &inode->data.map.extents;
+  off_t first_idx = ROUND_DOWN (offset / DISK_SECTOR_SIZE, BLOCK_SECTORS);
+  off_t sector_cnt = ROUND_UP (DIV_ROUND_UP (offset + size, DISK_SECTOR_SIZE),
+                               BLOCK_SECTORS);
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (size <= 0)
+    return true;
+  if (first_idx > (off_t) map->sector_cnt
+      && !extents_append (inode, 0, first_idx - map->sector_cnt))
+    return false;
+  if (first_idx < (off_t) map->sector_cnt
+      && !extents_fill (inode, first_idx,
+                        (sector_cnt < (off_t) map->sector_cnt
+                         ? sector_cnt : (off_t) map->sector_cnt),
+                        offset, size))
+    return false;
+
+  while ((off_t) map->sector_cnt < sector_cnt)
+    {
+      off_t first = map->sector_cnt;
+      size_t cnt = sector_cnt - first;
+      disk_sector_t start = 0;
+      disk_sector_t goal = 0;
+
+      /* Find a run of free sectors, right after the end of the
+         file's data if possible, or else near it or the inode. */
+      if (first > 0)
+        goal = extents_get_sector (inode, first - 1);
+      if (goal != 0 && free_map_allocate_at (goal + 1, cnt))
+        start = goal + 1;
+      else if (!allocate_run (goal != 0 ? goal + 1 : inode->sector + 1,
+                              &start, &cnt))
+        return false;
+
+      /* Zero the parts of it that readers could see early. */
+      zero_run (inode, start, first, cnt, offset, size);
+
+      if (!extents_append (inode, start, cnt))
+        {
+          release_sectors (start, cnt);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Moves the data of INODE, which must be inline, out to a data
+   block and switches INODE to the map its magic names.  The
+   caller must hold INODE's lock.
+   Returns true if successful, false if the disk is full. */
+static bool
+inline_migrate (struct inode *inode)
+{
+  struct inode_disk *data = &inode->data;
+  off_t length = inode_length (inode);
+  disk_sector_t sector = 0;
+
+  ASSERT (is_inline (inode));
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (length > 0)
+    {
+      struct cache_block *block;
+
+      if (!allocate_sector (inode, &sector, false))
+        return false;
+      block = cache_lock (sector, EXCLUSIVE);
+      memcpy (cache_zero (block), data->map.bytes, length);
+      dirty_data (inode, block);
+      cache_unlock (block);
+      zero_run (inode, sector + 1, 1, BLOCK_SECTORS - 1, 0, 0);
+    }
+
+  rwlock_acquire_write (&inode->map_lock);
+  memset (&data->map, 0, sizeof data->map);
+  if (data->magic == INLINE_EXTENT_MAGIC)
+    {
+      data->magic = EXTENT_MAGIC;
+      if (sector != 0)
+        {
+          data->map.extents.extents[0].start = sector;
+          data->map.extents.extents[0].length = block_sectors;
+          data->map.extents.extent_cnt = 1;
+          data->map.extents.sector_cnt = block_sectors;
+        }
+    }
+  else
+    {
+      data->magic = INODE_MAGIC;
+      data->map.sectors[0] = sector;
+    }
+  rwlock_release_write (&inode->map_lock);
+
+  inode_write_disk (inode);
+  return true;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+   INODE, or 0 if that sector has not been allocated. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos)
+{
+  disk_sector_t sector;
+
+  ASSERT (inode != NULL);
+  if (is_inline (inode))
+    return 0;
+  if (uses_extents (inode))
+    return extents_get_sector (inode, pos / DISK_SECTOR_SIZE);
+  blocks_get_sector (inode, pos / DISK_SECTOR_SIZE, false, 0, 0, &sector);
+  return sector;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+   INODE, or 0 if that sector has not been allocated. */
+disk_sector_t
+inode_get_sector (struct inode *inode, off_t pos)
+{
+  return byte_to_sector (inode, pos);
+}
+
+/* Notes the start of a read or write of INODE, counting it in
+   *OVERLAP_CNT if another one is under way.  Reads take no lock
+   on the inode, nor do writes within its length except to fill
+   holes, so these counts show how often accesses to one file run
+   in parallel.  Does nothing unless inode_count_overlaps is set,
+   since counting disables interrupts on every access. */
+static void
+begin_access (struct inode *inode, long long *overlap_cnt)
+{
+  if (inode_count_overlaps)
+    {
+      enum intr_level old_level = intr_disable ();
+      if (inode->access_cnt++ > 0)
+        (*overlap_cnt)++;
+      intr_set_level (old_level);
+    }
+}
+
+/* Notes the end of a read or write of INODE. */
+static void
+end_access (struct inode *inode)
+{
+  if (inode_count_overlaps)
+    {
+      enum intr_level old_level = intr_disable ();
+      inode->access_cnt--;
+      intr_set_level (old_level);
+    }
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
-  while (size > 0) 
+  begin_access (inode, &read_overlap_cnt);
+
+  /* Copy inline data straight out of the inode.  It cannot move
+     out to a data sector while we hold the map lock. */
+  if (is_inline (inode))
+    {
+      rwlock_acquire_read (&inode->map_lock);
+      if (is_inline (inode))
+        {
+          bytes_read = inode_length (inode) - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          if (bytes_read > 0)
+            memcpy (buffer, inode->data.map.bytes + offset, bytes_read);
+          else
+            bytes_read = 0;
+          rwlock_release_read (&inode->map_lock);
+          end_access (inode);
+          return bytes_read;
+        }
+      rwlock_release_read (&inode->map_lock);
+    }
+
+  while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector (inode, offset);
+      disk_sector_t sector_idx;
       int sector_ofs = offset % DISK_SECTOR_SIZE;
+      struct cache_block *block;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -223,107 +1320,508 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+      /* Copy out of the cached sector.  A sector that was never
+         written reads as zeros. */
+      sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx != 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+          block = cache_lock (sector_idx, NON_EXCLUSIVE);
+          memcpy (buffer + bytes_read,
+                  (uint8_t *) cache_read (block) + sector_ofs, chunk_size);
+          cache_unlock (block);
         }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (DISK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          disk_read (filesys_disk, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
-      
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
+  end_access (inode);
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Allocates the sectors of INODE needed for a write of SIZE bytes
+   at OFFSET and writes the free map changes back.  The caller
+   must hold INODE's lock. */
+static void
+allocate (struct inode *inode, off_t offset, off_t size)
+{
+  if (uses_extents (inode))
+    extents_allocate (inode, offset, size);
+  else
+    blocks_allocate (inode, offset, size);
+  free_map_sync ();
+}
+
+/* Writes are done in chunks of at most WRITE_CHUNK bytes, each
+   within one WRITE_CHUNK-aligned span of the file, so that the
+   journal blocks a chunk may add are bounded. */
+#define WRITE_CHUNK_SECTORS 8
+#define WRITE_CHUNK (WRITE_CHUNK_SECTORS * DISK_SECTOR_SIZE)
+
+/* Returns the most blocks, besides free map sectors, that a
+   write of SIZE bytes at OFFSET, within one chunk, can add to the
+   journal: the inode, its journaled data sectors (plus one, for
+   data moved out of the inode), and the index blocks it changes.
+   Filling a hole in an extent map shifts the extents after it,
+   which can change every leaf in use. */
+static size_t
+write_reservation (const struct inode *inode, off_t offset, off_t size)
+{
+  size_t blocks = 1;
+
+  if (inode->journaled)
+    blocks += DIV_ROUND_UP (offset % DISK_SECTOR_SIZE + size,
+                            DISK_SECTOR_SIZE) + 1;
+  if (uses_extents (inode)
+      && offset / DISK_SECTOR_SIZE < (off_t) inode->data.map.extents.sector_cnt)
+    blocks += 1 + LEAF_MAX;
+  else
+    blocks += 3;
+  return blocks;
+}
+
+/* Begins a journal operation for a write of SIZE bytes at OFFSET
+   within one chunk of INODE, and acquires INODE's lock.  The
+   write's reservation can only grow once the lock is held, if
+   another writer extends INODE meanwhile, in which case the
+   operation is extended, or begun again if the journal has no
+   room. */
+static void
+begin_write (struct inode *inode, off_t offset, off_t size)
+{
+  size_t blocks = write_reservation (inode, offset, size);
+
+  for (;;)
+    {
+      size_t needed;
+
+      journal_begin (blocks);
+      lock_acquire (&inode->lock);
+      needed = write_reservation (inode, offset, size);
+      if (needed <= blocks || journal_nested ()
+          || journal_extend (needed - blocks))
+        return;
+      lock_release (&inode->lock);
+      journal_end ();
+      blocks = needed;
+    }
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   all within one chunk.  Returns the number of bytes actually
+   written, as for inode_write_at(). */
+static off_t
+write_chunk (struct inode *inode, const uint8_t *buffer, off_t size,
+             off_t offset)
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool extending, locked;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  /* A write that extends the file, goes to inline data, or
+     changes metadata holds INODE's lock throughout, within a
+     journal operation: extending writes serialize against each
+     other, and no reader or writer reaches the sectors one did
+     not zero before the new length is set.  Other writes run in
+     parallel, taking the lock only to fill holes below.  The
+     length only grows, so a write that does not extend the file
+     now never will. */
+  extending = offset + size > inode_length (inode);
+  locked = extending || is_inline (inode) || inode->journaled;
+  if (locked)
+    {
+      begin_write (inode, offset, size);
+      extending = offset + size > inode_length (inode);
+    }
+  if (locked && is_inline (inode))
+    {
+      /* Write inline data in place, if it still fits. */
+      if (offset + size <= INLINE_SIZE)
+        {
+          rwlock_acquire_write (&inode->map_lock);
+          memcpy (inode->data.map.bytes + offset, buffer, size);
+          if (extending)
+            inode->data.length = offset + size;
+          rwlock_release_write (&inode->map_lock);
+          inode_write_disk (inode);
+          lock_release (&inode->lock);
+          journal_end ();
+          return size;
+        }
+      if (!inline_migrate (inode))
+        {
+          lock_release (&inode->lock);
+          journal_end ();
+          return 0;
+        }
+    }
+  if (locked)
+    allocate (inode, offset, size);
 
-  while (size > 0) 
+  while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
       disk_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % DISK_SECTOR_SIZE;
+      struct cache_block *block;
+      uint8_t *sector_data;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      /* Number of bytes to actually write into this sector.
+         Stop at the first sector that could not be allocated. */
+      int chunk_size = size < sector_left ? size : sector_left;
       if (chunk_size <= 0)
         break;
-
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+      if (sector_idx == 0 && !locked)
         {
-          /* Write full sector directly to disk. */
-          disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+          /* Fill the holes in the rest of the write at once. */
+          begin_write (inode, offset, size);
+          allocate (inode, offset, size);
+          lock_release (&inode->lock);
+          journal_end ();
+          sector_idx = byte_to_sector (inode, offset);
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (DISK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      if (sector_idx == 0)
+        break;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            disk_read (filesys_disk, sector_idx, bounce);
-          else
-            memset (bounce, 0, DISK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          disk_write (filesys_disk, sector_idx, bounce); 
-        }
+      /* If the sector contains data before or after the chunk
+         we're writing, then we need to read in the sector
+         first.  Otherwise we start with a sector of all zeros. */
+      cache_throttle ();
+      block = cache_lock (sector_idx, EXCLUSIVE);
+      if (sector_ofs > 0 || chunk_size < sector_left)
+        sector_data = cache_read (block);
+      else
+        sector_data = cache_zero (block);
+      memcpy (sector_data + sector_ofs, buffer + bytes_written, chunk_size);
+      dirty_data (inode, block);
+      cache_unlock (block);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file if we wrote past its end. */
+  if (extending && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      inode_write_disk (inode);
+    }
+  if (locked)
+    {
+      lock_release (&inode->lock);
+      journal_end ();
+    }
+
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or the maximum file size
+   is reached.  Writing past end of file extends the inode.
+   Each chunk of the write that changes metadata is a journal
+   operation of its own, unless the caller is in one already, so
+   a crash can leave a large write partly done, but never a chunk
+   of it. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  if (inode->deny_write_cnt || size <= 0)
+    return 0;
+
+  if (!uses_extents (inode) && size > INODE_SPAN - offset)
+    size = offset < INODE_SPAN ? INODE_SPAN - offset : 0;
+
+  begin_access (inode, &write_overlap_cnt);
+  while (size > 0)
+    {
+      off_t chunk_size = WRITE_CHUNK - offset % WRITE_CHUNK;
+      off_t written;
+
+      if (chunk_size > size)
+        chunk_size = size;
+      written = write_chunk (inode, buffer + bytes_written, chunk_size,
+                             offset);
+      bytes_written += written;
+      if (written < chunk_size)
+        break;
+      size -= written;
+      offset += written;
+    }
+  end_access (inode);
 
   return bytes_written;
 }
 
+/* Copies the CNT data sectors starting at FROM to the newly
+   allocated sectors starting at TO.  The copies are not
+   journaled, even for a journaled inode: nothing points to TO
+   until the operation that links it in commits, and a commit
+   writes unpinned blocks back before it logs anything. */
+static void
+copy_sectors (disk_sector_t from, disk_sector_t to, size_t cnt)
+{
+  uint8_t buffer[DISK_SECTOR_SIZE];
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_block *block = cache_lock (from + i, NON_EXCLUSIVE);
+      memcpy (buffer, cache_read (block), DISK_SECTOR_SIZE);
+      cache_unlock (block);
+
+      block = cache_lock (to + i, EXCLUSIVE);
+      memcpy (cache_zero (block), buffer, DISK_SECTOR_SIZE);
+      cache_dirty (block);
+      cache_unlock (block);
+    }
+}
+
+/* Points data block BLOCK_IDX of block-mapped INODE, which must
+   be allocated, at SECTOR. */
+static void
+blocks_set (struct inode *inode, off_t block_idx, disk_sector_t sector)
+{
+  size_t offsets[3];
+  size_t offset_cnt;
+  struct cache_block *block;
+  disk_sector_t index;
+  size_t level;
+
+  calculate_indices (block_idx, offsets, &offset_cnt);
+  if (offset_cnt == 1)
+    {
+      inode->data.map.sectors[offsets[0]] = sector;
+      inode_write_disk (inode);
+      return;
+    }
+
+  index = inode->data.map.sectors[offsets[0]];
+  for (level = 1; level + 1 < offset_cnt; level++)
+    {
+      block = cache_lock (index, NON_EXCLUSIVE);
+      index = ((disk_sector_t *) cache_read (block))[offsets[level]];
+      cache_unlock (block);
+    }
+  block = cache_lock (index, EXCLUSIVE);
+  ((disk_sector_t *) cache_read (block))[offsets[level]] = sector;
+  dirty_metadata (block);
+  cache_unlock (block);
+}
+
+/* Returns the number of data sectors allocated to INODE. */
+static off_t
+count_data_sectors (struct inode *inode)
+{
+  off_t cnt = 0;
+  off_t i;
+
+  if (is_inline (inode))
+    return 0;
+  else if (uses_extents (inode))
+    {
+      for (i = 0; i < (off_t) inode->data.map.extents.extent_cnt; i++)
+        {
+          struct extent e = get_extent (inode, i);
+          if (e.start != 0)
+            cnt += e.length;
+        }
+    }
+  else
+    {
+      for (i = 0; i < DIV_ROUND_UP (inode_length (inode), DISK_SECTOR_SIZE);
+           i += BLOCK_SECTORS)
+        {
+          disk_sector_t sector;
+          blocks_get_sector (inode, i, false, 0, 0, &sector);
+          if (sector != 0)
+            cnt += BLOCK_SECTORS;
+        }
+    }
+  return cnt;
+}
+
+/* Starts moving the CNT data sectors of INODE at FROM to the
+   sectors at TO, which the caller has allocated, as a journal
+   operation of its own: copies the data there.  The caller must
+   then link TO in, which changes one index block of a block map
+   but may shift every extent of an extent map, and call
+   end_move(). */
+static void
+begin_move (struct inode *inode, disk_sector_t from, disk_sector_t to,
+            size_t cnt)
+{
+  journal_begin (uses_extents (inode) ? 2 + LEAF_MAX : 1);
+  lock_acquire (&inode->lock);
+  copy_sectors (from, to, cnt);
+}
+
+/* Finishes the move begun by begin_move() of the CNT data sectors
+   of INODE at FROM, by releasing them. */
+static void
+end_move (struct inode *inode, disk_sector_t from, size_t cnt)
+{
+  release_sectors (from, cnt);
+  free_map_sync ();
+  lock_release (&inode->lock);
+  journal_end ();
+}
+
+/* Moves the data blocks of block-mapped INODE, in file order, to
+   the allocated sectors starting at START.
+   Returns the sector just past the last one used. */
+static disk_sector_t
+blocks_move (struct inode *inode, disk_sector_t start)
+{
+  off_t sector_idx;
+
+  for (sector_idx = 0;
+       sector_idx < DIV_ROUND_UP (inode_length (inode), DISK_SECTOR_SIZE);
+       sector_idx += BLOCK_SECTORS)
+    {
+      disk_sector_t old;
+
+      blocks_get_sector (inode, sector_idx, false, 0, 0, &old);
+      if (old == 0)
+        continue;
+      begin_move (inode, old, start, block_sectors);
+      blocks_set (inode, sector_idx / BLOCK_SECTORS, start);
+      end_move (inode, old, block_sectors);
+      start += block_sectors;
+    }
+  return start;
+}
+
+/* Moves the data extents of extent-mapped INODE, in file order,
+   to the allocated sectors starting at START, joining each to the
+   one before it where no hole separates them.
+   Returns the sector just past the last one used. */
+static disk_sector_t
+extents_move (struct inode *inode, disk_sector_t start)
+{
+  off_t idx;
+
+  for (idx = 0; idx < (off_t) inode->data.map.extents.extent_cnt; idx++)
+    {
+      struct extent e = get_extent (inode, idx);
+      struct extent new = {start, e.length};
+      off_t first = idx;
+
+      if (e.start == 0)
+        continue;
+      begin_move (inode, e.start, start, e.length);
+      if (idx > 0)
+        {
+          struct extent prev = get_extent (inode, idx - 1);
+          if (prev.start != 0 && prev.start + prev.length == start)
+            {
+              first--;
+              new.start = prev.start;
+              new.length += prev.length;
+            }
+        }
+      extents_replace (inode, first, idx - first + 1, &new, 1);
+      end_move (inode, e.start, e.length);
+      idx = first;
+      start += e.length;
+    }
+  return start;
+}
+
+/* Moves the data of INODE into one run of consecutive sectors
+   near INODE, if a free run that long exists, and releases the
+   sectors it occupied.  Holes stay holes, and index blocks stay
+   where they are.  The whole run is allocated first, so that no
+   other allocation can take part of it, and each data block or
+   extent then moves into it as a journal operation of its own,
+   so that a crash leaves INODE's data intact, if only partly
+   moved, though the unused rest of the run stays allocated.  No
+   other thread may use INODE meanwhile.
+   Returns true if successful, false if no free run is long
+   enough. */
+bool
+inode_defragment (struct inode *inode)
+{
+  off_t sector_cnt = count_data_sectors (inode);
+  disk_sector_t start, end;
+
+  if (sector_cnt == 0)
+    return true;
+
+  if (!free_map_allocate (sector_cnt, inode->sector + 1, &start))
+    return false;
+  end = (uses_extents (inode)
+         ? extents_move (inode, start)
+         : blocks_move (inode, start));
+
+  /* Release any of the run that the data did not fill. */
+  if (end < start + sector_cnt)
+    {
+      journal_begin (0);
+      free_map_release (end, start + sector_cnt - end);
+      free_map_sync ();
+      journal_end ();
+    }
+  inode->alloc_goal = end;
+  return true;
+}
+
+/* Returns the most index blocks that a file of LENGTH bytes in
+   the format of new inodes can need, if it has no holes: at worst,
+   an extent map holds one extent per block. */
+size_t
+inode_index_blocks (off_t length)
+{
+  off_t blocks = DIV_ROUND_UP (length, BLOCK_SECTORS * DISK_SECTOR_SIZE);
+
+  if (inode_format == INODE_EXTENTS)
+    return (blocks <= INLINE_EXTENT_CNT ? 0
+            : 1 + DIV_ROUND_UP (blocks - INLINE_EXTENT_CNT, LEAF_EXTENT_CNT));
+  else if (blocks <= DIRECT_CNT)
+    return 0;
+  else if (blocks <= DIRECT_CNT + PTRS_PER_SECTOR)
+    return 1;
+  else
+    return 2 + DIV_ROUND_UP (blocks - DIRECT_CNT - PTRS_PER_SECTOR,
+                             PTRS_PER_SECTOR);
+}
+
+/* Starts reading the sectors of INODE that hold the SIZE bytes
+   starting at OFFSET into the buffer cache in the background.
+   Bytes past the end of INODE, and sectors not yet allocated, are
+   ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+       offset += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
-inode_deny_write (struct inode *inode) 
+inode_deny_write (struct inode *inode)
 {
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
@@ -333,7 +1831,7 @@ inode_deny_write (struct inode *inode)
    Must be called once by each inode opener who has called
    inode_deny_write() on the inode, before closing the inode. */
 void
-inode_allow_write (struct inode *inode) 
+inode_allow_write (struct inode *inode)
 {
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
@@ -346,3 +1844,32 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Prints inode statistics. */
+void
+inode_print_stats (void)
+{
+  printf ("Inodes: %lld opens from cache, %lld opens read from disk, "
+          "%lld index sectors read, %lld overlapping reads, "
+          "%lld overlapping writes\n",
+          open_hit_cnt, open_miss_cnt, index_read_cnt,
+          read_overlap_cnt, write_overlap_cnt);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, hash_elem);
+  const struct inode *b = hash_entry (b_, struct inode, hash_elem);
+  return a->sector < b->sector;
+}
@@ -7,17 +7,41 @@
 
 struct bitmap;
 
+/* Ways of mapping file offsets to disk sectors. */
+enum inode_format
+  {
+    INODE_BLOCKS,               /* Direct and indirect blocks. */
+    INODE_EXTENTS               /* Runs of consecutive sectors. */
+  };
+
+/* Format of newly created inodes. */
+extern enum inode_format inode_format;
+
+/* Count overlapping reads and writes? */
+extern bool inode_count_overlaps;
+
 void inode_init (void);
 bool inode_create (disk_sector_t, off_t);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
+enum inode_format inode_get_format (const struct inode *);
+disk_sector_t inode_get_sector (struct inode *, off_t pos);
+disk_sector_t inode_get_dir_index (const struct inode *);
+void inode_set_dir_index (struct inode *, disk_sector_t);
+void inode_journal_data (struct inode *);
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+bool inode_defragment (struct inode *);
+size_t inode_index_blocks (off_t length);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_print_stats (void);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,457 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/disk.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+
+   Each operation that changes metadata, such as creating or
+   removing a file or growing one, runs between journal_begin()
+   and journal_end().  The metadata blocks it dirties are added to
+   the running transaction by journal_add(), which pins them in
+   the buffer cache so that none reaches its home sector early.
+   Operations do not commit one by one: a transaction gathers the
+   blocks of every operation that begins while it runs, and
+   commits when it is nearly full, when the flusher asks for it,
+   or at shutdown.
+
+   To commit, all unpinned dirty blocks are written back first,
+   so that file data reaches the disk before metadata that points
+   to it.  Then the transaction is written to the log as one
+   sequential run of sectors: a descriptor that lists the blocks'
+   home sectors, the blocks themselves, and a commit record.
+   Last, the blocks are unpinned and written home, and the
+   header's sequence number advances past the transaction.  If
+   the system stops after the commit record is written but before
+   the header is, journal_open() copies the logged blocks home at
+   the next boot.
+
+   A transaction has room for `capacity' blocks, no more than the
+   buffer cache can pin (CACHE_PIN_MAX), of which each
+   running operation reserves as many as it says it may add, plus
+   the free map's sectors, so an operation waits to begin until
+   its reservation fits.  Since the reservations of running
+   operations never exceed the room left, a block added to a full
+   transaction means some operation added more than it reserved,
+   and the kernel panics rather than lose its atomicity.
+
+   A disk formatted without a journal has none in sector
+   JOURNAL_SECTOR, and then all of these functions but
+   journal_commit() do nothing. */
+
+#define JOURNAL_MAGIC 0x4a524e4c        /* Header. */
+#define DESCRIPTOR_MAGIC 0x4a524e44     /* Transaction descriptor. */
+#define COMMIT_MAGIC 0x4a524e43         /* Commit record. */
+
+/* Most blocks in a logged transaction, which sets the size of
+   the log.  A descriptor sector lists at most 125.  Transactions
+   written now hold at most CACHE_PIN_MAX blocks, but replay takes
+   any that fit the log. */
+#define JOURNAL_BLOCKS 120
+
+/* Journal header, in sector JOURNAL_SECTOR.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Next transaction's number. */
+    disk_sector_t start;                /* First sector of log. */
+    uint32_t sector_cnt;                /* Number of sectors in log. */
+    uint8_t unused[DISK_SECTOR_SIZE - 16];
+  };
+
+/* First sector of a logged transaction.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct descriptor
+  {
+    unsigned magic;                     /* DESCRIPTOR_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t block_cnt;                 /* Number of blocks. */
+    disk_sector_t sectors[JOURNAL_BLOCKS]; /* Home sector of each. */
+    uint8_t unused[DISK_SECTOR_SIZE - 12
+                   - JOURNAL_BLOCKS * sizeof (disk_sector_t)];
+  };
+
+/* Last sector of a logged transaction.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct commit_record
+  {
+    unsigned magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t block_cnt;                 /* Number of blocks. */
+    uint8_t unused[DISK_SECTOR_SIZE - 12];
+  };
+
+/* Commit at the end of every operation?
+   Controlled by kernel command-line option "-jsync". */
+bool journal_sync;
+
+/* Leave the last transaction unwritten at home at shutdown?
+   Controlled by kernel command-line option "-jcrash". */
+bool journal_crash;
+
+static bool enabled;                    /* Does the disk have a journal? */
+static struct journal_header header;    /* Copy of the header. */
+
+/* Protects the members below. */
+static struct lock journal_lock;
+
+/* Signaled when a commit finishes or an operation ends. */
+static struct condition journal_changed;
+
+static size_t capacity;                 /* Blocks a transaction can hold. */
+static int outstanding;                 /* Operations running. */
+static size_t reserved;                 /* Blocks they reserved. */
+static bool committing;                 /* Commit in progress? */
+static bool commit_wanted;              /* Commit when operations end? */
+static bool checkpoint = true;          /* Write committed blocks home? */
+static disk_sector_t sectors[JOURNAL_BLOCKS]; /* Blocks in transaction. */
+static size_t block_cnt;                /* Number of blocks. */
+
+/* Transaction as written to the log. */
+static uint8_t log_buf[JOURNAL_BLOCKS + 2][DISK_SECTOR_SIZE];
+
+/* Statistics. */
+static long long txn_cnt;               /* Transactions committed. */
+static long long op_cnt;                /* Operations begun. */
+static long long logged_cnt;            /* Blocks written to the log. */
+
+static void write_header (void);
+static void do_commit (void);
+
+/* Initializes the journal module. */
+void
+journal_init (void)
+{
+  ASSERT (sizeof (struct journal_header) == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct descriptor) == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct commit_record) == DISK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_changed);
+}
+
+/* Allocates an empty log near the start of the disk and writes
+   a header that points to it.  Called while formatting, before
+   the free map is written. */
+void
+journal_create (void)
+{
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.seq = 1;
+  header.sector_cnt = JOURNAL_BLOCKS + 2;
+  if (!free_map_allocate (header.sector_cnt, JOURNAL_SECTOR + 1,
+                          &header.start))
+    PANIC ("journal creation failed");
+  write_header ();
+  capacity = CACHE_PIN_MAX;
+  enabled = true;
+}
+
+/* Reads the journal header and replays the transaction in the
+   log, if it was committed but not checkpointed.  Must be called
+   before any metadata is read. */
+void
+journal_open (void)
+{
+  struct descriptor *d = (struct descriptor *) log_buf[0];
+  struct commit_record *c;
+  size_t log_blocks;
+  size_t i;
+
+  disk_read (filesys_disk, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    return;
+  log_blocks = header.sector_cnt - 2;
+  if (log_blocks > JOURNAL_BLOCKS)
+    log_blocks = JOURNAL_BLOCKS;
+  capacity = log_blocks < CACHE_PIN_MAX ? log_blocks : CACHE_PIN_MAX;
+  enabled = true;
+
+  /* Is there a complete transaction in the log? */
+  disk_read (filesys_disk, header.start, d);
+  if (d->magic != DESCRIPTOR_MAGIC || d->seq != header.seq
+      || d->block_cnt > log_blocks)
+    return;
+  c = (struct commit_record *) log_buf[d->block_cnt + 1];
+  disk_read (filesys_disk, header.start + d->block_cnt + 1, c);
+  if (c->magic != COMMIT_MAGIC || c->seq != d->seq
+      || c->block_cnt != d->block_cnt)
+    return;
+
+  /* Copy its blocks home. */
+  disk_read_multiple (filesys_disk, header.start + 1, d->block_cnt,
+                      log_buf[1]);
+  for (i = 0; i < d->block_cnt; i++)
+    disk_write (filesys_disk, d->sectors[i], log_buf[i + 1]);
+  printf ("journal: replayed transaction %"PRIu32", %"PRIu32" sectors\n",
+          d->seq, d->block_cnt);
+  header.seq++;
+  write_header ();
+}
+
+/* Writes the in-memory header to its sector. */
+static void
+write_header (void)
+{
+  disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* Begins an operation that changes metadata and may add up to
+   BLOCKS blocks to the journal, besides free map sectors.  Waits
+   until the running transaction has room for it, committing the
+   transaction first if need be.  Operations nest: only the
+   outermost one in a thread counts, and BLOCKS is ignored for the
+   others.  The caller must hold no cache blocks, and should hold
+   no locks that another operation might wait for. */
+void
+journal_begin (size_t blocks)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0 || !enabled)
+    return;
+
+  blocks += free_map_sector_cnt ();
+  if (blocks > capacity)
+    PANIC ("journal operation needs %zu blocks, log holds %zu",
+           blocks, capacity);
+
+  lock_acquire (&journal_lock);
+  while (committing || commit_wanted
+         || block_cnt + reserved + blocks > capacity)
+    {
+      if (!committing && outstanding == 0 && block_cnt > 0)
+        {
+          /* Make room ourselves. */
+          committing = true;
+          lock_release (&journal_lock);
+          do_commit ();
+          lock_acquire (&journal_lock);
+          continue;
+        }
+      if (!committing && outstanding > 0 && block_cnt > 0)
+        commit_wanted = true;
+      cond_wait (&journal_changed, &journal_lock);
+    }
+  outstanding++;
+  reserved += blocks;
+  t->journal_blocks = blocks;
+  op_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Reserves BLOCKS more blocks for the running thread's operation,
+   if the running transaction has room for them.
+   Returns true if successful, or if the thread is not in an
+   operation.  Returns false without waiting if there is no room:
+   an operation that can must then end, and begin again with the
+   larger reservation. */
+bool
+journal_extend (size_t blocks)
+{
+  struct thread *t = thread_current ();
+  bool success;
+
+  if (t->journal_depth == 0 || !enabled)
+    return true;
+
+  lock_acquire (&journal_lock);
+  success = block_cnt + reserved + blocks <= capacity;
+  if (success)
+    {
+      reserved += blocks;
+      t->journal_blocks += blocks;
+    }
+  lock_release (&journal_lock);
+  return success;
+}
+
+/* Returns true if the running thread's journal operation is
+   nested in another, whose reservation covers it. */
+bool
+journal_nested (void)
+{
+  return thread_current ()->journal_depth > 1;
+}
+
+/* Ends an operation begun by journal_begin().  When the last
+   running operation ends, commits the transaction if an operation
+   or the flusher asked for it, if it cannot take another
+   operation, or if journal_sync is set. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  bool commit;
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0 || !enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  outstanding--;
+  reserved -= t->journal_blocks;
+  commit = (outstanding == 0
+            && (commit_wanted || journal_sync
+                || (block_cnt + JOURNAL_OP_BLOCKS + free_map_sector_cnt ()
+                    > capacity)));
+  if (commit)
+    committing = true;
+  else
+    cond_broadcast (&journal_changed, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (commit)
+    do_commit ();
+}
+
+/* Adds BLOCK, which the caller has locked exclusively and marked
+   dirty, to the running transaction, and pins it in the cache
+   until the transaction commits.  Does nothing outside an
+   operation. */
+void
+journal_add (struct cache_block *block)
+{
+  disk_sector_t sector;
+  size_t i;
+
+  if (!enabled || thread_current ()->journal_depth == 0)
+    return;
+
+  sector = cache_get_sector (block);
+  lock_acquire (&journal_lock);
+  for (i = 0; i < block_cnt; i++)
+    if (sectors[i] == sector)
+      break;
+  if (i == block_cnt)
+    {
+      if (block_cnt >= capacity)
+        PANIC ("journal transaction overflow at sector %"PRDSNu, sector);
+      sectors[block_cnt++] = sector;
+    }
+  cache_pin (block);
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction and writes back every dirty
+   block, as the flusher does periodically.  If operations are
+   running, writes back only the blocks outside the transaction,
+   and asks the last operation to end to commit it. */
+void
+journal_commit (void)
+{
+  bool commit;
+
+  if (!enabled)
+    {
+      cache_flush ();
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_changed, &journal_lock);
+  commit = outstanding == 0;
+  if (commit)
+    committing = true;
+  else if (block_cnt > 0)
+    commit_wanted = true;
+  lock_release (&journal_lock);
+
+  if (commit)
+    do_commit ();
+  else
+    cache_flush ();
+}
+
+/* Commits the running transaction at shutdown.  With
+   journal_crash, only logs it, as if the system stopped right
+   after writing the commit record, so that the next boot has to
+   replay it. */
+void
+journal_close (void)
+{
+  if (journal_crash)
+    checkpoint = false;
+  journal_commit ();
+}
+
+/* Writes the running transaction to the log, then home.
+   The caller must have set `committing', so that no operation
+   runs meanwhile. */
+static void
+do_commit (void)
+{
+  struct descriptor *d = (struct descriptor *) log_buf[0];
+  struct commit_record *c = (struct commit_record *) log_buf[block_cnt + 1];
+  size_t i;
+
+  /* Write data first. */
+  cache_flush ();
+
+  if (block_cnt > 0)
+    {
+      /* Log the transaction. */
+      memset (d, 0, sizeof *d);
+      d->magic = DESCRIPTOR_MAGIC;
+      d->seq = header.seq;
+      d->block_cnt = block_cnt;
+      memcpy (d->sectors, sectors, sizeof *sectors * block_cnt);
+      for (i = 0; i < block_cnt; i++)
+        {
+          struct cache_block *b = cache_lock (sectors[i], NON_EXCLUSIVE);
+          memcpy (log_buf[i + 1], cache_read (b), DISK_SECTOR_SIZE);
+          cache_unlock (b);
+        }
+      memset (c, 0, sizeof *c);
+      c->magic = COMMIT_MAGIC;
+      c->seq = header.seq;
+      c->block_cnt = block_cnt;
+      disk_write_multiple (filesys_disk, header.start, block_cnt + 2,
+                           log_buf);
+      txn_cnt++;
+      logged_cnt += block_cnt;
+
+      /* Checkpoint it. */
+      if (checkpoint)
+        {
+          for (i = 0; i < block_cnt; i++)
+            {
+              struct cache_block *b = cache_lock (sectors[i], EXCLUSIVE);
+              cache_unpin (b);
+              cache_unlock (b);
+            }
+          cache_flush ();
+          header.seq++;
+          write_header ();
+        }
+      else
+        printf ("journal: left transaction %"PRIu32", %zu sectors, "
+                "in the log\n", header.seq, block_cnt);
+    }
+
+  lock_acquire (&journal_lock);
+  block_cnt = 0;
+  committing = commit_wanted = false;
+  cond_broadcast (&journal_changed, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  if (enabled)
+    printf ("Journal: %lld transactions, %lld operations, "
+            "%lld sectors logged\n",
+            txn_cnt, op_cnt, logged_cnt);
+}
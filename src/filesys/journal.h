@@ -0,0 +1,48 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct cache_block;
+
+/* Commit at the end of every operation?
+   Controlled by kernel command-line option "-jsync". */
+extern bool journal_sync;
+
+/* Leave the last transaction unwritten at home at shutdown?
+   Controlled by kernel command-line option "-jcrash". */
+extern bool journal_crash;
+
+/* Operations and reservations.
+
+   Each operation passes journal_begin() the most blocks it can
+   add to the journal, not counting free map sectors, which are
+   reserved for it in addition: free_map_sync() may write any of
+   them.  An operation that adds more blocks than it reserved
+   panics.  JOURNAL_OP_BLOCKS covers creating, removing or closing
+   a file.  Writes reserve per chunk (see inode_write_at()), and a
+   nested operation adds to its outer one's blocks, which the
+   outer one must have reserved or obtained from journal_extend().
+
+   Within an operation, the order in which blocks are added does
+   not matter, because they all commit together: nothing commits
+   until the outermost operation ends.  free_map_sync() may
+   therefore run before the caller's other metadata is final, as
+   filesys_create() and inode_close() do, provided the operation
+   leaves the file system consistent by the time it ends. */
+#define JOURNAL_OP_BLOCKS 12
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_begin (size_t blocks);
+bool journal_extend (size_t blocks);
+bool journal_nested (void);
+void journal_end (void);
+void journal_add (struct cache_block *);
+void journal_commit (void);
+void journal_close (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
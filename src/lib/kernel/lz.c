@@ -0,0 +1,154 @@
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* Compressed data is a sequence of runs, each introduced by a
+   control byte C:
+
+     - If C < 0x80, C + 1 literal bytes follow.
+
+     - Otherwise, (C & 0x7f) + LZ_MIN_MATCH bytes are copied from
+       earlier output.  The distance back, 1 to 65535 bytes, follows
+       as two bytes, least significant first.  A match may overlap
+       the bytes it produces, so a run of one repeated byte costs
+       three bytes per LZ_MAX_MATCH bytes of output.
+
+   Matches are found through a hash table of recent positions,
+   keyed on the next four bytes, as in LZ4.  The table may go
+   stale (only the most recent position per hash is kept), which
+   costs compression ratio but never correctness. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+
+/* Returns the match table slot for the four bytes at P. */
+static unsigned
+hash_seq (const uint8_t *p)
+{
+  uint32_t seq;
+
+  memcpy (&seq, p, sizeof seq);
+  return (seq * 2654435761u) >> (32 - LZ_TABLE_BITS);
+}
+
+/* Appends the CNT literal bytes at SRC to DST, whose first *OP
+   bytes are in use and which has room for DST_MAX bytes.
+   Returns true if successful, false if DST is too small. */
+static bool
+emit_literals (const uint8_t *src, size_t cnt,
+               uint8_t *dst, size_t *op, size_t dst_max)
+{
+  while (cnt > 0)
+    {
+      size_t run = cnt < LZ_MAX_LITERALS ? cnt : LZ_MAX_LITERALS;
+      if (*op + 1 + run > dst_max)
+        return false;
+      dst[(*op)++] = run - 1;
+      memcpy (dst + *op, src, run);
+      *op += run;
+      src += run;
+      cnt -= run;
+    }
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC into DST, which has room
+   for DST_MAX bytes, using TABLE as scratch space.
+   Returns the compressed size, or 0 if it would exceed
+   DST_MAX. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_max,
+             uint16_t table[LZ_TABLE_SIZE])
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0;                /* Next input position. */
+  size_t lit = 0;               /* Start of pending literals. */
+  size_t op = 0;                /* Output size. */
+
+  ASSERT (src_size <= LZ_MAX_INPUT);
+
+  /* Table entries are positions plus 1, so that 0 is empty. */
+  memset (table, 0, LZ_TABLE_SIZE * sizeof *table);
+
+  while (ip + LZ_MIN_MATCH <= src_size)
+    {
+      unsigned h = hash_seq (src + ip);
+      size_t cand = table[h];
+
+      table[h] = ip + 1;
+      if (cand != 0 && !memcmp (src + cand - 1, src + ip, LZ_MIN_MATCH))
+        {
+          size_t ref = cand - 1;
+          size_t len = LZ_MIN_MATCH;
+          size_t dist = ip - ref;
+
+          while (ip + len < src_size && len < LZ_MAX_MATCH
+                 && src[ref + len] == src[ip + len])
+            len++;
+
+          if (!emit_literals (src + lit, ip - lit, dst, &op, dst_max)
+              || op + 3 > dst_max)
+            return 0;
+          dst[op++] = 0x80 | (len - LZ_MIN_MATCH);
+          dst[op++] = dist & 0xff;
+          dst[op++] = dist >> 8;
+          ip += len;
+          lit = ip;
+        }
+      else
+        ip++;
+    }
+
+  if (!emit_literals (src + lit, src_size - lit, dst, &op, dst_max))
+    return 0;
+  return op;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lz_compress(), into the DST_SIZE bytes at DST.
+   Returns true if successful, false if SRC is malformed or does
+   not decompress to exactly DST_SIZE bytes. */
+bool
+lz_decompress (const void *src_, size_t src_size,
+               void *dst_, size_t dst_size)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0;
+  size_t op = 0;
+
+  while (ip < src_size)
+    {
+      uint8_t c = src[ip++];
+
+      if (c < 0x80)
+        {
+          size_t run = c + 1;
+          if (ip + run > src_size || op + run > dst_size)
+            return false;
+          memcpy (dst + op, src + ip, run);
+          ip += run;
+          op += run;
+        }
+      else
+        {
+          size_t len = (c & 0x7f) + LZ_MIN_MATCH;
+          size_t dist;
+
+          if (ip + 2 > src_size)
+            return false;
+          dist = src[ip] | (src[ip + 1] << 8);
+          ip += 2;
+          if (dist == 0 || dist > op || op + len > dst_size)
+            return false;
+
+          /* Byte by byte, since the match may overlap. */
+          for (; len > 0; len--, op++)
+            dst[op] = dst[op - dist];
+        }
+    }
+  return op == dst_size;
+}
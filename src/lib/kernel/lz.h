@@ -0,0 +1,24 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fast LZ77-style compression for small blocks such as pages. */
+
+/* Entries in the match table that the caller passes to
+   lz_compress(). */
+#define LZ_TABLE_BITS 12
+#define LZ_TABLE_SIZE (1u << LZ_TABLE_BITS)
+
+/* Largest block that can be compressed. */
+#define LZ_MAX_INPUT 65535
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_max,
+                    uint16_t table[LZ_TABLE_SIZE]);
+bool lz_decompress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
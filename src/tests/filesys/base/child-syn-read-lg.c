@@ -0,0 +1,41 @@
+/* Child process for syn-read-lg test.
+   Reads the contents of a test file a block at a time, while
+   other processes read it too. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-read-lg.h"
+
+static char buf[BUF_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  int fd;
+  size_t ofs;
+
+  test_name = "child-syn-read-lg";
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < sizeof buf; ofs += BLOCK_SIZE) 
+    {
+      char block[BLOCK_SIZE];
+      CHECK (read (fd, block, BLOCK_SIZE) == BLOCK_SIZE,
+             "read \"%s\"", file_name);
+      compare_bytes (block, buf + ofs, BLOCK_SIZE, ofs, file_name);
+    }
+  close (fd);
+
+  return child_idx;
+}
@@ -0,0 +1,27 @@
+# -*- perl -*-
+# Runs lg-random with the file system and scratch disks attached
+# as virtio-blk devices by --virtio, and checks that the file
+# system disk was used as one.  This checks only that the driver
+# works: its 512-byte transfers are not the 4 kB random transfers
+# to benchmark against IDE.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-random-virtio) begin
+(lg-random-virtio) create "bazzle"
+(lg-random-virtio) open "bazzle"
+(lg-random-virtio) write "bazzle" in random order
+(lg-random-virtio) read "bazzle" in random order
+(lg-random-virtio) close "bazzle"
+(lg-random-virtio) end
+EOF
+check_stat ("detection of vd0:1", qr/^vd0:1: detected /);
+my ($reads, $writes) = check_stat ("statistics for vd0:1",
+				   qr/^vd0:1: (\d+) reads, (\d+) writes,/);
+fail "vd0:1 was never read.\n" if $reads == 0;
+fail "vd0:1 was never written.\n" if $writes == 0;
+our ($test);
+fail "File system disk was also attached as IDE.\n"
+  if grep (/^hd0:1: /, read_text_file ("$test.output"));
+pass;
@@ -0,0 +1,22 @@
+# -*- perl -*-
+# Runs lg-seq-block on a file system formatted with 4-sector
+# blocks.  Compare its timer ticks with those of lg-seq-block to
+# see what the block size buys.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-bs4) begin
+(lg-seq-bs4) create "noodle"
+(lg-seq-bs4) open "noodle"
+(lg-seq-bs4) writing "noodle"
+(lg-seq-bs4) close "noodle"
+(lg-seq-bs4) open "noodle" for verification
+(lg-seq-bs4) verified contents of "noodle"
+(lg-seq-bs4) close "noodle"
+(lg-seq-bs4) end
+EOF
+my ($bs) = check_stat ("free map statistics",
+		      qr/^Free map: .*, (\d+) sectors per block$/);
+fail "File system has $bs-sector blocks, not 4.\n" if $bs != 4;
+pass;
@@ -0,0 +1,25 @@
+# -*- perl -*-
+# Runs lg-seq-block and checks that the file system disk
+# transferred data by bus-master DMA.  Compare its kernel ticks
+# with those of lg-seq-pio, run with DMA disabled by -pio.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-dma) begin
+(lg-seq-dma) create "noodle"
+(lg-seq-dma) open "noodle"
+(lg-seq-dma) writing "noodle"
+(lg-seq-dma) close "noodle"
+(lg-seq-dma) open "noodle" for verification
+(lg-seq-dma) verified contents of "noodle"
+(lg-seq-dma) close "noodle"
+(lg-seq-dma) end
+EOF
+my ($detected) = check_stat ("detection of hd0:1",
+			    qr/^hd0:1: detected (.*)$/);
+fail "hd0:1 was not set up for DMA.\n" if $detected !~ /, DMA$/;
+my ($dma) = check_stat ("statistics for hd0:1",
+		       qr/^hd0:1: .*, (\d+) sectors by DMA$/);
+fail "hd0:1 transferred nothing by DMA.\n" if $dma == 0;
+pass;
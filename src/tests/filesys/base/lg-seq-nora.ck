@@ -0,0 +1,21 @@
+# -*- perl -*-
+# Runs lg-seq-block with read-ahead disabled by -ra=0 and checks
+# that the buffer cache read nothing ahead.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-nora) begin
+(lg-seq-nora) create "noodle"
+(lg-seq-nora) open "noodle"
+(lg-seq-nora) writing "noodle"
+(lg-seq-nora) close "noodle"
+(lg-seq-nora) open "noodle" for verification
+(lg-seq-nora) verified contents of "noodle"
+(lg-seq-nora) close "noodle"
+(lg-seq-nora) end
+EOF
+my ($ra) = check_stat ("buffer cache statistics",
+		      qr/^Buffer cache: .*, (\d+) sectors read ahead,/);
+fail "Buffer cache read $ra sectors ahead with -ra=0.\n" if $ra != 0;
+pass;
@@ -0,0 +1,24 @@
+# -*- perl -*-
+# Runs lg-seq-block with DMA disabled by -pio and checks that the
+# file system disk transferred nothing by DMA.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-pio) begin
+(lg-seq-pio) create "noodle"
+(lg-seq-pio) open "noodle"
+(lg-seq-pio) writing "noodle"
+(lg-seq-pio) close "noodle"
+(lg-seq-pio) open "noodle" for verification
+(lg-seq-pio) verified contents of "noodle"
+(lg-seq-pio) close "noodle"
+(lg-seq-pio) end
+EOF
+my ($detected) = check_stat ("detection of hd0:1",
+			    qr/^hd0:1: detected (.*)$/);
+fail "hd0:1 was set up for DMA despite -pio.\n" if $detected =~ /, DMA$/;
+my ($dma) = check_stat ("statistics for hd0:1",
+		       qr/^hd0:1: .*, (\d+) sectors by DMA$/);
+fail "hd0:1 transferred $dma sectors by DMA despite -pio.\n" if $dma != 0;
+pass;
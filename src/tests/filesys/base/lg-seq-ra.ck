@@ -0,0 +1,22 @@
+# -*- perl -*-
+# Runs lg-seq-block and checks that the buffer cache read sectors
+# ahead of its sequential reads.  Compare its buffer cache hits
+# and misses with those of lg-seq-nora, run with -ra=0.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-ra) begin
+(lg-seq-ra) create "noodle"
+(lg-seq-ra) open "noodle"
+(lg-seq-ra) writing "noodle"
+(lg-seq-ra) close "noodle"
+(lg-seq-ra) open "noodle" for verification
+(lg-seq-ra) verified contents of "noodle"
+(lg-seq-ra) close "noodle"
+(lg-seq-ra) end
+EOF
+my ($ra) = check_stat ("buffer cache statistics",
+		      qr/^Buffer cache: .*, (\d+) sectors read ahead,/);
+fail "Buffer cache read nothing ahead.\n" if $ra == 0;
+pass;
@@ -0,0 +1,29 @@
+# -*- perl -*-
+# Runs lg-seq-block with the file system and scratch disks
+# attached as virtio-blk devices by --virtio, and checks that the
+# file system disk was used as one.  This checks only that the
+# driver works: the file is far smaller than the 1 MB sequential
+# transfers to benchmark against IDE.
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-virtio) begin
+(lg-seq-virtio) create "noodle"
+(lg-seq-virtio) open "noodle"
+(lg-seq-virtio) writing "noodle"
+(lg-seq-virtio) close "noodle"
+(lg-seq-virtio) open "noodle" for verification
+(lg-seq-virtio) verified contents of "noodle"
+(lg-seq-virtio) close "noodle"
+(lg-seq-virtio) end
+EOF
+check_stat ("detection of vd0:1", qr/^vd0:1: detected /);
+my ($reads, $writes) = check_stat ("statistics for vd0:1",
+				   qr/^vd0:1: (\d+) reads, (\d+) writes,/);
+fail "vd0:1 was never read.\n" if $reads == 0;
+fail "vd0:1 was never written.\n" if $writes == 0;
+our ($test);
+fail "File system disk was also attached as IDE.\n"
+  if grep (/^hd0:1: /, read_text_file ("$test.output"));
+pass;
@@ -0,0 +1,9 @@
+#ifndef TESTS_FILESYS_BASE_SYN_READ_LG_H
+#define TESTS_FILESYS_BASE_SYN_READ_LG_H
+
+#define CHILD_CNT 4
+#define BLOCK_SIZE 512
+#define BUF_SIZE (128 * BLOCK_SIZE)
+static const char file_name[] = "data";
+
+#endif /* tests/filesys/base/syn-read-lg.h */
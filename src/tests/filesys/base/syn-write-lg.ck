@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-write-lg) begin
+(syn-write-lg) create "stuff"
+(syn-write-lg) exec child 1 of 4: "child-syn-wrt-lg 0"
+(syn-write-lg) exec child 2 of 4: "child-syn-wrt-lg 1"
+(syn-write-lg) exec child 3 of 4: "child-syn-wrt-lg 2"
+(syn-write-lg) exec child 4 of 4: "child-syn-wrt-lg 3"
+(syn-write-lg) wait for child 1 of 4 returned 0 (expected 0)
+(syn-write-lg) wait for child 2 of 4 returned 1 (expected 1)
+(syn-write-lg) wait for child 3 of 4 returned 2 (expected 2)
+(syn-write-lg) wait for child 4 of 4 returned 3 (expected 3)
+(syn-write-lg) open "stuff"
+(syn-write-lg) read "stuff"
+(syn-write-lg) end
+EOF
+my ($overlaps) = check_stat ("inode statistics",
+			    qr/^Inodes: .*, (\d+) overlapping writes/);
+fail "No write of the file overlapped another.\n" if $overlaps == 0;
+pass;
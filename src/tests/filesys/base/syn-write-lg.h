@@ -0,0 +1,9 @@
+#ifndef TESTS_FILESYS_BASE_SYN_WRITE_LG_H
+#define TESTS_FILESYS_BASE_SYN_WRITE_LG_H
+
+#define CHILD_CNT 4
+#define CHUNK_SIZE (32 * 512)
+#define BUF_SIZE (CHILD_CNT * CHUNK_SIZE)
+static const char file_name[] = "stuff";
+
+#endif /* tests/filesys/base/syn-write-lg.h */
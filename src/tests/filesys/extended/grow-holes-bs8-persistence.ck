@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($bs) = check_stat ("free map statistics",
+		      qr/^Free map: .*, (\d+) sectors per block$/);
+fail "File system was mounted with $bs-sector blocks, not 8.\n"
+  if $bs != 8;
+my ($data) = "\0" x 40000;
+substr ($data, 1000, 200) = 'a' x 200;
+substr ($data, 9000, 5000) = 'b' x 5000;
+substr ($data, 21000, 10) = 'c' x 10;
+substr ($data, 39990, 10) = 'd' x 10;
+check_archive ({"testfile" => [$data]});
+pass;
@@ -0,0 +1,44 @@
+/* Writes short runs of bytes at increasing offsets past the end
+   of a file, on a file system formatted with 8-sector blocks.
+   Each run starts and ends partway into a block, and the holes
+   between them span both whole and partial blocks, all of which
+   must read back as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Runs to write, in order: offset and length. */
+static const struct
+  {
+    size_t ofs, size;
+  }
+runs[] = {{1000, 200}, {9000, 5000}, {21000, 10}, {39990, 10}};
+
+#define RUN_CNT (sizeof runs / sizeof *runs)
+
+static char buf[40000];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < RUN_CNT; i++)
+    {
+      memset (buf + runs[i].ofs, 'a' + i, runs[i].size);
+      seek (fd, runs[i].ofs);
+      CHECK (write (fd, buf + runs[i].ofs, runs[i].size)
+             == (int) runs[i].size,
+             "write %zu bytes at offset %zu in \"%s\"",
+             runs[i].size, runs[i].ofs, file_name);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
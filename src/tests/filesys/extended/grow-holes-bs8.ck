@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-holes-bs8) begin
+(grow-holes-bs8) create "testfile"
+(grow-holes-bs8) open "testfile"
+(grow-holes-bs8) write 200 bytes at offset 1000 in "testfile"
+(grow-holes-bs8) write 5000 bytes at offset 9000 in "testfile"
+(grow-holes-bs8) write 10 bytes at offset 21000 in "testfile"
+(grow-holes-bs8) write 10 bytes at offset 39990 in "testfile"
+(grow-holes-bs8) close "testfile"
+(grow-holes-bs8) open "testfile" for verification
+(grow-holes-bs8) verified contents of "testfile"
+(grow-holes-bs8) close "testfile"
+(grow-holes-bs8) end
+EOF
+my ($bs) = check_stat ("free map statistics",
+		      qr/^Free map: .*, (\d+) sectors per block$/);
+fail "File system has $bs-sector blocks, not 8.\n" if $bs != 8;
+pass;
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($bs) = check_stat ("free map statistics",
+		      qr/^Free map: .*, (\d+) sectors per block$/);
+fail "File system was mounted with $bs-sector blocks, not 8.\n"
+  if $bs != 8;
+check_archive ({"testme" => [random_bytes (72943)]});
+pass;
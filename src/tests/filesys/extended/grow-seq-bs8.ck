@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seq-bs8) begin
+(grow-seq-bs8) create "testme"
+(grow-seq-bs8) open "testme"
+(grow-seq-bs8) writing "testme"
+(grow-seq-bs8) close "testme"
+(grow-seq-bs8) open "testme" for verification
+(grow-seq-bs8) verified contents of "testme"
+(grow-seq-bs8) close "testme"
+(grow-seq-bs8) end
+EOF
+my ($bs) = check_stat ("free map statistics",
+		      qr/^Free map: .*, (\d+) sectors per block$/);
+fail "File system has $bs-sector blocks, not 8.\n" if $bs != 8;
+pass;
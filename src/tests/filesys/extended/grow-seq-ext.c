@@ -0,0 +1,7 @@
+/* Grows a file from 0 bytes to 72,943 bytes, 1,234 bytes at a
+   time, on a file system formatted with extent-based inodes.
+   Each write should lengthen the file's last extent, so that no
+   index sector is ever read. */
+
+#define TEST_SIZE 72943
+#include "tests/filesys/extended/grow-seq.inc"
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seq-ext) begin
+(grow-seq-ext) create "testme"
+(grow-seq-ext) open "testme"
+(grow-seq-ext) writing "testme"
+(grow-seq-ext) close "testme"
+(grow-seq-ext) open "testme" for verification
+(grow-seq-ext) verified contents of "testme"
+(grow-seq-ext) close "testme"
+(grow-seq-ext) end
+EOF
+my ($index) = check_stat ("inode statistics",
+			 qr/^Inodes: .*, (\d+) index sectors read,/);
+fail "Read $index index sectors with extent-based inodes.\n" if $index != 0;
+pass;
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+our ($test);
+fail "The journal was not replayed at boot.\n"
+  if !grep (/^journal: replayed transaction \d+, [1-9]\d* sectors$/,
+	    read_text_file ("$test.output"));
+check_archive ({'a' => {'b' => [random_bytes (5678)]}});
+pass;
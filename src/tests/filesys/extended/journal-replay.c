@@ -0,0 +1,28 @@
+/* Creates a directory and a file in it, writes the file, and
+   creates and removes another file.  Run with -jcrash, which
+   leaves the last transaction in the journal without writing it
+   home at power off, so the persistence check sees these changes
+   only if the next boot replays the journal. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 0), "create \"a/b\"");
+  CHECK ((fd = open ("a/b")) > 1, "open \"a/b\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"a/b\"");
+  msg ("close \"a/b\"");
+  close (fd);
+  CHECK (create ("c", 512), "create \"c\"");
+  CHECK (remove ("c"), "remove \"c\"");
+}
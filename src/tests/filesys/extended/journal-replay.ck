@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-replay) begin
+(journal-replay) mkdir "a"
+(journal-replay) create "a/b"
+(journal-replay) open "a/b"
+(journal-replay) write "a/b"
+(journal-replay) close "a/b"
+(journal-replay) create "c"
+(journal-replay) remove "c"
+(journal-replay) end
+EOF
+our ($test);
+fail "No transaction was left in the journal at power off.\n"
+  if !grep (/^journal: left transaction \d+, [1-9]\d* sectors, in the log$/,
+	    read_text_file ("$test.output"));
+pass;
@@ -129,6 +129,20 @@ EOF
     fail;
 }
 
+# Returns the values captured by $regexp from the first line of
+# the test's output that it matches, such as a statistic printed
+# at power off.  Fails, saying that $what is missing, if no line
+# matches.
+sub check_stat {
+    my ($what, $regexp) = @_;
+
+    for my $line (read_text_file ("$test.output")) {
+	my (@values) = $line =~ /$regexp/;
+	return @values if @values;
+    }
+    fail "\u$what missing from output.\n";
+}
+
 # Get @output without header or trailer.
 sub get_core_output {
     my ($run, @output) = @_;
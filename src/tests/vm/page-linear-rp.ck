@@ -0,0 +1,25 @@
+# -*- perl -*-
+# Check for page-linear-POLICY, which runs page-linear with
+# -rp=POLICY: the output must match page-linear's, and pages must
+# have been evicted, by POLICY.
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my ($name) = $test =~ m%([^/]+)$%;
+my ($policy) = $name =~ /^page-linear-(.+)$/;
+die "$name: not a page-linear-POLICY test\n" if !defined $policy;
+check_expected (IGNORE_EXIT_CODES => 1,
+		[join ('', map ("($name) $_\n",
+				'begin',
+				'initialize',
+				'read pass',
+				'read/modify/write pass one',
+				'read/modify/write pass two',
+				'read pass',
+				'end'))]);
+my ($evictions, $used) = check_stat ("paging statistics",
+				     qr/^Paging: .*, (\d+) evictions by (\S+)$/);
+fail "Pages were evicted by $used, not $policy.\n" if $used ne $policy;
+fail "No page was evicted, so the policy never ran.\n" if $evictions == 0;
+pass;
@@ -29,10 +29,25 @@
 #else
 #include "tests/threads/tests.h"
 #endif
+#ifdef VM
+#include "vm/bench.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/policy.h"
+#include "vm/swap.h"
+#include "vm/zcache.h"
+#endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #endif
 
 /* Amount of physical memory, in 4 kB pages. */
@@ -87,6 +102,10 @@ main (void)
   palloc_init ();
   malloc_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+  page_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -112,8 +131,12 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   disk_init ();
+  virtio_blk_init ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -239,6 +262,22 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-extents"))
+        inode_format = INODE_EXTENTS;
+      else if (!strcmp (name, "-bs"))
+        block_sectors = atoi (value);
+      else if (!strcmp (name, "-ra"))
+        readahead_max = atoi (value);
+      else if (!strcmp (name, "-wb"))
+        cache_flush_interval = atoi (value);
+      else if (!strcmp (name, "-jsync"))
+        journal_sync = true;
+      else if (!strcmp (name, "-jcrash"))
+        journal_crash = true;
+      else if (!strcmp (name, "-pio"))
+        disk_use_dma = false;
+      else if (!strcmp (name, "-overlaps"))
+        inode_count_overlaps = true;
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -247,6 +286,21 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        stack_page_limit = atoi (value);
+      else if (!strcmp (name, "-fa"))
+        fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-vmstats"))
+        page_print_process_stats = true;
+      else if (!strcmp (name, "-rp"))
+        {
+          if (!policy_select (value))
+            PANIC ("unknown replacement policy `%s'", value);
+        }
+      else if (!strcmp (name, "-zc"))
+        zcache_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -291,8 +345,14 @@ run_actions (char **argv)
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
+      {"sync", 1, fsutil_sync},
+      {"layout", 1, fsutil_layout},
+      {"defrag", 1, fsutil_defrag},
       {"put", 2, fsutil_put},
       {"get", 2, fsutil_get},
+#endif
+#ifdef VM
+      {"vmbench", 1, vm_bench},
 #endif
       {NULL, 0, NULL},
     };
@@ -339,9 +399,15 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  sync               Write dirty file system buffers to disk.\n"
+          "  layout             Show how fragmented each file is.\n"
+          "  defrag             Move each file's data into consecutive sectors.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  put FILE           Put FILE into file system from scratch disk.\n"
           "  get FILE           Get FILE from file system into scratch disk.\n"
+#endif
+#ifdef VM
+          "  vmbench            Compare page replacement policies.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -349,8 +415,28 @@ usage (void)
           "  -f                 Format file system disk during startup.\n"
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+#ifdef FILESYS
+          "  -extents           With -f, format with extent-based inodes.\n"
+          "  -bs=SECTORS        With -f, format with blocks of SECTORS sectors.\n"
+          "  -ra=SECTORS        Read ahead up to SECTORS sectors (0 disables).\n"
+          "  -wb=TICKS          Write dirty buffers back every TICKS timer ticks.\n"
+          "  -jsync             Commit the journal after every operation.\n"
+          "  -jcrash            At power off, log the last transaction but\n"
+          "                     leave it for the next boot to replay.\n"
+          "  -pio               Use PIO instead of DMA for IDE disks.\n"
+          "  -overlaps          Count reads and writes that overlap others\n"
+          "                     on the same file.\n"
+#endif
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -sl=COUNT          Limit user stack growth to COUNT pages.\n"
+          "  -fa=COUNT          Map up to COUNT neighbouring pages per fault.\n"
+          "  -vmstats           Print page fault counters on process exit.\n"
+          "  -rp=NAME           Use page replacement policy NAME: clock (default),\n"
+          "                     esc, aging, or wsclock.\n"
+          "  -zc=COUNT          Keep up to COUNT pages of compressed swap in RAM.\n"
 #endif
           );
   power_off ();
@@ -398,10 +484,18 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
+  inode_print_stats ();
+  dcache_print_stats ();
+  journal_print_stats ();
+  free_map_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  page_print_stats ();
+#endif
 }
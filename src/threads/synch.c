@@ -336,3 +336,82 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes readers-writer lock RW.  Any number of readers may
+   hold RW at once, or a single writer.  Waiting writers take
+   precedence over readers that arrive later, so that a steady
+   stream of readers cannot starve a writer.  RW is not
+   recursive. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers);
+  cond_init (&rw->writers);
+  rw->reader_cnt = 0;
+  rw->writer_cnt = 0;
+  rw->waiting_writer_cnt = 0;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  while (rw->writer_cnt > 0 || rw->waiting_writer_cnt > 0)
+    cond_wait (&rw->readers, &rw->lock);
+  rw->reader_cnt++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->reader_cnt > 0);
+  if (--rw->reader_cnt == 0)
+    cond_signal (&rw->writers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or writer
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writer_cnt++;
+  while (rw->reader_cnt > 0 || rw->writer_cnt > 0)
+    cond_wait (&rw->writers, &rw->lock);
+  rw->waiting_writer_cnt--;
+  rw->writer_cnt++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for writing,
+   and wakes up the next writer or else all waiting readers. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer_cnt == 1);
+  rw->writer_cnt = 0;
+  if (rw->waiting_writer_cnt > 0)
+    cond_signal (&rw->writers, &rw->lock);
+  else
+    cond_broadcast (&rw->readers, &rw->lock);
+  lock_release (&rw->lock);
+}
@@ -6,6 +6,10 @@
 #include <stdint.h>
 #include "filesys/file.h"
 #include "threads/synch.h"
+#ifdef VM
+#include <hash.h>
+#include "vm/page.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -106,6 +110,24 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+
+    /* Owned by userprog/syscall.c. */
+    void *user_esp;                     /* User %esp at last syscall. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    struct page_stats page_stats;       /* Page fault counters. */
+
+    /* Owned by userprog/process.c. */
+    struct file *exec_file;             /* Executable, for demand paging. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal operations. */
+    size_t journal_blocks;              /* Blocks the operation reserved. */
 #endif
 
     /* Owned by thread.c. */
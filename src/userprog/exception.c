@@ -4,6 +4,9 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +151,22 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in pages that are part of the process but not yet
+     present, growing the stack for accesses just below the stack
+     pointer, and copy shared zero pages on first write.  A fault
+     taken in the kernel (e.g. while a system call writes into a
+     user buffer) does not have the user's %esp in F, so use the
+     one saved at system call entry. */
+  {
+    void *esp = user ? f->esp : thread_current ()->user_esp;
+    if (page_fault_in (fault_addr, write, esp))
+      return;
+  }
+#endif
+
+  /* Any other fault is an invalid access: report it and kill the
+     process, or panic if it happened in the kernel. */
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -17,6 +17,9 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
@@ -126,6 +129,15 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+#ifdef VM
+  /* Free the process's pages, and then the executable that
+     backed them. */
+  if (cur->pagedir != NULL)
+    page_table_destroy ();
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -247,6 +259,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL)
     goto done;
+#ifdef VM
+  if (!page_table_init ())
+    goto done;
+#endif
   process_activate ();
 
   /* Set up stack. */
@@ -380,13 +396,25 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* Pages are read from the executable on demand, so keep it
+     open, and unmodified, for as long as the process runs. */
+  if (success)
+    {
+      file_deny_write (file);
+      t->exec_file = file;
+      return success;
+    }
+#endif
   file_close (file);
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -454,9 +482,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage, uint32_t page_offset
   ASSERT ((page_offset + read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
 
+#ifndef VM
   struct thread *t = thread_current();
 
   file_seek (file, ofs);
+#endif
   while (read_bytes > 0 || zero_bytes > 0)
     {
       /* Calculate how to fill this page.
@@ -468,6 +498,27 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage, uint32_t page_offset
 
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page comes from, so that it is read in
+         on first access.  A page shared with the previous
+         segment is already recorded; bring it in now and add our
+         part of it. */
+      size_t chunk = page_read_bytes - page_offset;
+      if (!page_add_file (upage, file, ofs, page_offset, chunk, writable))
+        {
+          uint8_t *kpage = page_lock_frame (upage);
+          bool ok;
+          if (kpage == NULL)
+            return false;
+          ok = file_read_at (file, kpage + page_offset, chunk, ofs)
+               == (int) chunk;
+          memset (kpage + page_read_bytes, 0, page_zero_bytes);
+          page_unlock_frame (upage);
+          if (!ok)
+            return false;
+        }
+      ofs += chunk;
+#else
       /* Get a page of memory. */
       bool new_kpage = false;
       uint8_t *kpage = pagedir_get_page (t->pagedir, upage);
@@ -499,6 +550,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage, uint32_t page_offset
                   return false;
             }
       }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes - page_offset;
@@ -514,6 +566,17 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage, uint32_t page_offset
 static bool
 setup_stack (void **esp)
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  /* Make the page part of the process, so that it is freed and
+     paged like any other, and bring it in right away. */
+  if (!page_add_zero (upage, true) || page_lock_frame (upage) == NULL)
+    return false;
+  page_unlock_frame (upage);
+  *esp = PHYS_BASE -12;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -527,8 +590,10 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -548,3 +613,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -6,6 +6,9 @@
 #include "filesys/filesys.h"
 #include "threads/init.h"
 #include "devices/input.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 
@@ -17,6 +20,10 @@ static void
 syscall_handler (struct intr_frame *f UNUSED) {
 
   int syscall_nr = * (int*) f->esp;
+
+  /* Remember the user stack pointer, so that page faults taken
+     inside the kernel on behalf of this call can grow the stack. */
+  thread_current ()->user_esp = f->esp;
   
   switch(syscall_nr){
     case SYS_HALT:
@@ -77,51 +84,75 @@ void read_call(struct intr_frame *f){
   char *buffer = *(void**) (f->esp + 8);
   unsigned size = *(unsigned*) (f->esp + 12);
 
+#ifdef VM
+  // The file system must not fault on the buffer while it holds
+  // the disk, and the pages must not be evicted under it either,
+  // so bring every page of it in and pin it.
+  if (!page_pin_range (buffer, size, true))
+    thread_exit ();
+#endif
+
   // read from console
   if (fd == 0){ 
     for (unsigned i = 0; i < size; i++){
       buffer[i] = input_getc();
     }
     f -> eax = size;
-    return;
   }
 
   // Illegal argument
-  if (fd == 1){
+  else if (fd == 1){
     f -> eax = -1;
-    return;
   }
 
   // Read from file
-  int read_bits = (int) file_read(thread_get_file(fd), buffer, size);
-  if(read_bits == 0){
-    read_bits = -1;
+  else {
+    int read_bits = (int) file_read(thread_get_file(fd), buffer, size);
+    if(read_bits == 0){
+      read_bits = -1;
+    }
+    f -> eax = read_bits;
   }
-  f -> eax = read_bits;
+
+#ifdef VM
+  page_unpin_range (buffer, size);
+#endif
 }
 
 void write_call (struct intr_frame *f){
   int fd = *(int*) (f-> esp + 4);
   const void *buffer = *(void**) (f->esp + 8);
   unsigned size = *(unsigned*) (f->esp + 12);
+
+#ifdef VM
+  // The file system must not fault on the buffer while it holds
+  // the disk, and the pages must not be evicted under it either,
+  // so bring every page of it in and pin it.
+  if (!page_pin_range (buffer, size, false))
+    thread_exit ();
+#endif
   
   // Write to console
   if (fd == 1){ 
     putbuf(buffer, size);
     f -> eax = size; 
-    return;
   }
 
   // Illegal argument
-  if (fd == 0){
+  else if (fd == 0){
     f -> eax = -1;
-    return;
   }
   
   // Write to file
-  int written_bits = file_write(thread_get_file(fd), buffer, size);
-  if(written_bits == 0){
-    written_bits = -1;
+  else {
+    int written_bits = file_write(thread_get_file(fd), buffer, size);
+    if(written_bits == 0){
+      written_bits = -1;
+    }
+    f -> eax = written_bits;
   }
-  f -> eax = written_bits;
+
+#ifdef VM
+  page_unpin_range (buffer, size);
+#endif
 }
@@ -0,0 +1,468 @@
+#include "vm/bench.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/policy.h"
+#include "threads/malloc.h"
+
+/* Page replacement benchmark.
+
+   Replays the memory access patterns of some tests/vm workloads
+   against a simulated memory of a few frames, once for each
+   replacement policy, and reports the page faults and swap I/O
+   each policy causes.  The workloads run for real on real data,
+   so that data-dependent patterns such as merging and quick
+   sort are faithful, but each simulated page holds only
+   BENCH_PAGE_SIZE bytes instead of PGSIZE, so that the data fits
+   in kernel memory while page counts and access order match the
+   tests. */
+
+/* Bytes per simulated page. */
+#define BENCH_PAGE_SIZE 256
+
+/* Simulated memory. */
+struct bench
+  {
+    struct frame_set set;       /* The frames, as seen by the policy. */
+    const struct replacement_policy *policy;    /* Policy under test. */
+    uint32_t rng;               /* State of bench_random(). */
+    size_t page_cnt;            /* Number of pages. */
+    size_t frame_cnt;           /* Number of frames. */
+    uint8_t *data;              /* PAGE_CNT pages of workload data. */
+
+    /* Per page. */
+    size_t *page_frame;         /* Frame holding page, or SIZE_MAX. */
+    bool *private;              /* Written at least once? */
+    bool *swapped;              /* Copy in swap? */
+
+    /* Per frame. */
+    size_t *frame_page;         /* Page in frame, or SIZE_MAX. */
+    bool *accessed;             /* Simulated accessed bit. */
+    bool *dirty;                /* Simulated dirty bit. */
+
+    int64_t time;               /* Virtual time: references so far. */
+    unsigned faults;            /* Page faults. */
+    unsigned swap_reads;        /* Pages read from swap. */
+    unsigned swap_writes;       /* Pages written to swap. */
+  };
+
+/* A workload to replay. */
+struct workload
+  {
+    const char *name;                   /* Name of test replayed. */
+    size_t page_cnt;                    /* Pages of data. */
+    size_t frame_cnt;                   /* Frames of memory. */
+    void (*run) (struct bench *);       /* Runs the workload. */
+  };
+
+static bool
+bench_claim (struct frame_set *set UNUSED, size_t idx UNUSED)
+{
+  return true;
+}
+
+static void
+bench_release (struct frame_set *set UNUSED, size_t idx UNUSED)
+{
+}
+
+static bool
+bench_accessed (struct frame_set *set, size_t idx, bool clear)
+{
+  struct bench *b = (struct bench *) set;
+  bool accessed = b->accessed[idx];
+
+  if (clear)
+    b->accessed[idx] = false;
+  return accessed;
+}
+
+static bool
+bench_dirty (struct frame_set *set, size_t idx)
+{
+  struct bench *b = (struct bench *) set;
+  return b->dirty[idx] || b->private[b->frame_page[idx]];
+}
+
+static int64_t
+bench_now (struct frame_set *set)
+{
+  return ((struct bench *) set)->time;
+}
+
+/* Sets up B as an empty memory of FRAME_CNT frames for PAGE_CNT
+   pages, managed by POLICY.
+   Returns true if successful, false on memory allocation
+   failure. */
+static bool
+bench_init (struct bench *b, size_t page_cnt, size_t frame_cnt,
+            const struct replacement_policy *policy)
+{
+  size_t i;
+
+  memset (b, 0, sizeof *b);
+  b->policy = policy;
+  b->rng = 2463534242u;
+  b->page_cnt = page_cnt;
+  b->frame_cnt = frame_cnt;
+  b->data = malloc (page_cnt * BENCH_PAGE_SIZE);
+  b->page_frame = malloc (page_cnt * sizeof *b->page_frame);
+  b->private = calloc (page_cnt, sizeof *b->private);
+  b->swapped = calloc (page_cnt, sizeof *b->swapped);
+  b->frame_page = malloc (frame_cnt * sizeof *b->frame_page);
+  b->accessed = calloc (frame_cnt, sizeof *b->accessed);
+  b->dirty = calloc (frame_cnt, sizeof *b->dirty);
+  b->set.state = calloc (frame_cnt, sizeof *b->set.state);
+  if (b->data == NULL || b->page_frame == NULL || b->private == NULL
+      || b->swapped == NULL || b->frame_page == NULL
+      || b->accessed == NULL || b->dirty == NULL || b->set.state == NULL)
+    return false;
+
+  for (i = 0; i < page_cnt; i++)
+    b->page_frame[i] = SIZE_MAX;
+  for (i = 0; i < frame_cnt; i++)
+    b->frame_page[i] = SIZE_MAX;
+
+  b->set.cnt = frame_cnt;
+  b->set.tau = frame_cnt * BENCH_PAGE_SIZE;
+  b->set.claim = bench_claim;
+  b->set.release = bench_release;
+  b->set.accessed = bench_accessed;
+  b->set.dirty = bench_dirty;
+  b->set.now = bench_now;
+  return true;
+}
+
+/* Frees the memory owned by B. */
+static void
+bench_destroy (struct bench *b)
+{
+  free (b->data);
+  free (b->page_frame);
+  free (b->private);
+  free (b->swapped);
+  free (b->frame_page);
+  free (b->accessed);
+  free (b->dirty);
+  free (b->set.state);
+}
+
+/* Brings PAGE into a frame of B, evicting another page with the
+   policy under test if there is no free frame, in the
+   same way as the frame table and page_out(). */
+static size_t
+bench_fault (struct bench *b, size_t page)
+{
+  size_t f;
+
+  b->faults++;
+  for (f = 0; f < b->frame_cnt; f++)
+    if (b->frame_page[f] == SIZE_MAX)
+      break;
+  if (f == b->frame_cnt)
+    {
+      size_t victim;
+
+      f = b->policy->choose (&b->set);
+      ASSERT (f != POLICY_NONE);
+      victim = b->frame_page[f];
+      if (b->dirty[f])
+        b->private[victim] = true;
+      if (b->private[victim])
+        {
+          b->swapped[victim] = true;
+          b->swap_writes++;
+        }
+      b->page_frame[victim] = SIZE_MAX;
+    }
+
+  if (b->swapped[page])
+    {
+      b->swapped[page] = false;
+      b->swap_reads++;
+    }
+  b->frame_page[f] = page;
+  b->page_frame[page] = f;
+  b->dirty[f] = false;
+  policy_frame_loaded (&b->set, f);
+  return f;
+}
+
+/* Returns the next number in B's pseudo-random sequence
+   (Marsaglia's xorshift32).  Each run starts the sequence over,
+   so that every policy sees the same data, without disturbing
+   the kernel's random_ulong() sequence. */
+static unsigned long
+bench_random (struct bench *b)
+{
+  b->rng ^= b->rng << 13;
+  b->rng ^= b->rng >> 17;
+  b->rng ^= b->rng << 5;
+  return b->rng;
+}
+
+/* Records a reference to byte OFS of B's data, for writing if
+   WRITE is true. */
+static void
+bench_touch (struct bench *b, size_t ofs, bool write)
+{
+  size_t page = ofs / BENCH_PAGE_SIZE;
+  size_t f;
+
+  ASSERT (page < b->page_cnt);
+
+  b->time++;
+  f = b->page_frame[page];
+  if (f == SIZE_MAX)
+    f = bench_fault (b, page);
+  b->accessed[f] = true;
+  if (write)
+    b->dirty[f] = true;
+}
+
+/* Returns byte OFS of B's data. */
+static uint8_t
+ld (struct bench *b, size_t ofs)
+{
+  bench_touch (b, ofs, false);
+  return b->data[ofs];
+}
+
+/* Stores V into byte OFS of B's data. */
+static void
+st (struct bench *b, size_t ofs, uint8_t v)
+{
+  bench_touch (b, ofs, true);
+  b->data[ofs] = v;
+}
+
+/* Reads the SIZE bytes at OFS, as cksum() or write() does. */
+static void
+scan (struct bench *b, size_t ofs, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    ld (b, ofs + i);
+}
+
+/* Fills the SIZE bytes at OFS with random data, as read() into
+   a user buffer does. */
+static void
+fill_random (struct bench *b, size_t ofs, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    st (b, ofs + i, bench_random (b));
+}
+
+/* page-shuffle: initialize the buffer, then shuffle it and
+   checksum it ten times. */
+static void
+run_shuffle (struct bench *b)
+{
+  size_t size = b->page_cnt * BENCH_PAGE_SIZE;
+  size_t i, j;
+
+  for (i = 0; i < size; i++)
+    st (b, i, i * 257);
+  scan (b, 0, size);
+  for (j = 0; j < 10; j++)
+    {
+      for (i = 0; i < size; i++)
+        {
+          size_t k = i + bench_random (b) % (size - i);
+          uint8_t t = ld (b, i);
+          st (b, i, ld (b, k));
+          st (b, k, t);
+        }
+      scan (b, 0, size);
+    }
+}
+
+/* page-merge-*: fill BUF1 with random data, hand each chunk to a
+   child to sort (the child's own accesses happen in another
+   address space), merge the sorted chunks into BUF2 and verify
+   BUF2.  The seq, par, stk and mm variants differ only in where
+   the buffers live and how the children run, which does not
+   change the parent's access pattern. */
+#define MERGE_CHUNK_CNT 16
+
+static void
+run_merge (struct bench *b)
+{
+  size_t data_size = b->page_cnt / 2 * BENCH_PAGE_SIZE;
+  size_t chunk_size = data_size / MERGE_CHUNK_CNT;
+  size_t buf1 = 0, buf2 = data_size;
+  size_t mp[MERGE_CHUNK_CNT];
+  size_t mp_left;
+  size_t op;
+  size_t i;
+
+  /* init. */
+  fill_random (b, buf1, data_size);
+  scan (b, buf1, data_size);
+
+  /* sort_chunks: write() each chunk out, let the child sort it,
+     read() it back. */
+  for (i = 0; i < MERGE_CHUNK_CNT; i++)
+    {
+      size_t chunk = buf1 + i * chunk_size;
+      size_t histogram[256];
+      size_t v, j;
+
+      scan (b, chunk, chunk_size);
+      memset (histogram, 0, sizeof histogram);
+      for (j = 0; j < chunk_size; j++)
+        histogram[b->data[chunk + j]]++;
+      for (v = j = 0; v < 256; v++)
+        while (histogram[v]-- > 0)
+          st (b, chunk + j++, v);
+    }
+
+  /* merge. */
+  mp_left = MERGE_CHUNK_CNT;
+  for (i = 0; i < MERGE_CHUNK_CNT; i++)
+    mp[i] = buf1 + chunk_size * i;
+  op = buf2;
+  while (mp_left > 0)
+    {
+      size_t min = 0;
+      for (i = 1; i < mp_left; i++)
+        if (ld (b, mp[i]) < ld (b, mp[min]))
+          min = i;
+      st (b, op++, ld (b, mp[min]));
+      if ((++mp[min] - buf1) % chunk_size == 0)
+        mp[min] = mp[--mp_left];
+    }
+
+  /* verify. */
+  scan (b, buf2, data_size);
+}
+
+/* Partitions the SIZE bytes at OFS around PIVOT, as
+   tests/vm/qsort.c does, and returns the size of the left
+   part. */
+static size_t
+partition (struct bench *b, size_t ofs, size_t size, int pivot)
+{
+  size_t left_size = size;
+  size_t first = ofs;
+  size_t last = first + left_size;
+
+  for (;;)
+    {
+      for (;;)
+        {
+          if (first == last)
+            return left_size;
+          else if (ld (b, first) >= pivot)
+            break;
+          first++;
+        }
+      left_size--;
+
+      for (;;)
+        {
+          last--;
+          if (first == last)
+            return left_size;
+          else if (ld (b, last) < pivot)
+            break;
+          else
+            left_size--;
+        }
+
+      {
+        uint8_t t = ld (b, first);
+        st (b, first, ld (b, last));
+        st (b, last, t);
+      }
+      first++;
+    }
+}
+
+/* Sorts the SIZE bytes at OFS as qsort_bytes() does. */
+static void
+qsort_bytes (struct bench *b, size_t ofs, size_t size)
+{
+  size_t i;
+  int pivot;
+  size_t left_size, right_size;
+
+  for (i = 1; i < size; i++)
+    if (ld (b, ofs + i - 1) > ld (b, ofs + i))
+      break;
+  if (i >= size)
+    return;
+
+  pivot = ld (b, ofs + bench_random (b) % size);
+  left_size = partition (b, ofs, size, pivot);
+  right_size = size - left_size;
+  if (left_size <= right_size)
+    {
+      qsort_bytes (b, ofs, left_size);
+      qsort_bytes (b, ofs + left_size, right_size);
+    }
+  else
+    {
+      qsort_bytes (b, ofs + left_size, right_size);
+      qsort_bytes (b, ofs, left_size);
+    }
+}
+
+/* child-qsort: read() a file into the buffer, quick sort it and
+   write() it back. */
+static void
+run_qsort (struct bench *b)
+{
+  size_t size = b->page_cnt * BENCH_PAGE_SIZE;
+
+  fill_random (b, 0, size);
+  qsort_bytes (b, 0, size);
+  scan (b, 0, size);
+}
+
+/* The workloads, with as many pages as the tests use and half
+   or less as many frames, so that every policy has to evict. */
+static const struct workload workloads[] =
+  {
+    {"page-shuffle", 32, 16, run_shuffle},
+    {"page-merge", 2 * 252, 128, run_merge},
+    {"child-qsort", 32, 16, run_qsort},
+  };
+
+/* "vmbench" action: replays each workload under each replacement
+   policy and prints the faults and swap I/O that result.  Leaves
+   the frame table's policy and the kernel's random number
+   sequence alone. */
+void
+vm_bench (char **argv UNUSED)
+{
+  const struct workload *w;
+
+  printf ("%-14s %-8s %8s %10s %11s\n",
+          "workload", "policy", "faults", "swap reads", "swap writes");
+  for (w = workloads; w < workloads + sizeof workloads / sizeof *workloads;
+       w++)
+    {
+      const struct replacement_policy *const *p;
+
+      for (p = replacement_policies; *p != NULL; p++)
+        {
+          struct bench b;
+
+          if (!bench_init (&b, w->page_cnt, w->frame_cnt, *p))
+            {
+              printf ("vmbench: out of memory\n");
+              bench_destroy (&b);
+              return;
+            }
+          w->run (&b);
+          printf ("%-14s %-8s %8u %10u %11u\n", w->name, (*p)->name,
+                  b.faults, b.swap_reads, b.swap_writes);
+          bench_destroy (&b);
+        }
+    }
+}
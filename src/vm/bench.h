@@ -0,0 +1,6 @@
+#ifndef VM_BENCH_H
+#define VM_BENCH_H
+
+void vm_bench (char **argv);
+
+#endif /* vm/bench.h */
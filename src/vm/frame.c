@@ -0,0 +1,221 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include "vm/page.h"
+#include "vm/policy.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+
+/* Frame table.  Every page of the user pool is taken at boot
+   and handed out from here, so that when memory runs short a
+   victim can be chosen among all user frames. */
+static struct frame *frames;
+static size_t frame_cnt;
+
+/* Serializes searches for a free frame or a victim. */
+static struct lock scan_lock;
+
+/* The frames as seen by the replacement policy. */
+static struct frame_set frame_set;
+
+/* WSClock working set window, in timer ticks. */
+#define WSCLOCK_TAU (TIMER_FREQ / 2)
+
+static bool frame_claim (struct frame_set *, size_t idx);
+static void frame_release (struct frame_set *, size_t idx);
+static bool frame_accessed (struct frame_set *, size_t idx, bool clear);
+static bool frame_dirty (struct frame_set *, size_t idx);
+static int64_t frame_now (struct frame_set *);
+
+/* Tries to lock frame F without waiting.  A frame that the
+   current thread already holds, e.g. one pinned for a system
+   call, counts as busy too. */
+static bool
+frame_try_lock (struct frame *f)
+{
+  return (!lock_held_by_current_thread (&f->lock)
+          && lock_try_acquire (&f->lock));
+}
+
+/* Initializes the frame table, claiming every page in the user
+   pool. */
+void
+frame_init (void)
+{
+  void *base;
+
+  lock_init (&scan_lock);
+
+  frames = malloc (sizeof *frames * ram_pages);
+  if (frames == NULL)
+    PANIC ("out of memory allocating frame table");
+
+  while ((base = palloc_get_page (PAL_USER)) != NULL)
+    {
+      struct frame *f = &frames[frame_cnt++];
+      lock_init (&f->lock);
+      f->base = base;
+      f->page = NULL;
+    }
+
+  frame_set.cnt = frame_cnt;
+  frame_set.hand = 0;
+  frame_set.tau = WSCLOCK_TAU;
+  frame_set.state = calloc (frame_cnt, sizeof *frame_set.state);
+  if (frame_set.state == NULL && frame_cnt > 0)
+    PANIC ("out of memory allocating frame table");
+  frame_set.claim = frame_claim;
+  frame_set.release = frame_release;
+  frame_set.accessed = frame_accessed;
+  frame_set.dirty = frame_dirty;
+  frame_set.now = frame_now;
+}
+
+/* Tries to allocate and lock a frame for PAGE, evicting another
+   page if there is no free frame and MAY_EVICT is true.
+   Returns the frame if successful, a null pointer on failure. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page, bool may_evict)
+{
+  size_t i;
+
+  lock_acquire (&scan_lock);
+
+  /* Find a free frame. */
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+      if (!frame_try_lock (f))
+        continue;
+      if (f->page == NULL)
+        {
+          f->page = page;
+          policy_frame_loaded (&frame_set, i);
+          lock_release (&scan_lock);
+          return f;
+        }
+      lock_release (&f->lock);
+    }
+
+  /* No free frame.  Ask the policy for a victim and evict it. */
+  if (may_evict && frame_cnt > 0)
+    {
+      i = replacement_policy->choose (&frame_set);
+      if (i != POLICY_NONE)
+        {
+          struct frame *f = &frames[i];
+          if (f->page != NULL && !page_out (f->page))
+            {
+              lock_release (&f->lock);
+              lock_release (&scan_lock);
+              return NULL;
+            }
+          f->page = page;
+          policy_frame_loaded (&frame_set, i);
+          lock_release (&scan_lock);
+          return f;
+        }
+    }
+
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Allocates and locks a frame for PAGE, evicting another page if
+   necessary and MAY_EVICT is true.
+   Returns the frame if successful, a null pointer if every frame
+   stayed busy for a while or eviction failed. */
+struct frame *
+frame_alloc_and_lock (struct page *page, bool may_evict)
+{
+  size_t try;
+
+  for (try = 0; try < 3; try++)
+    {
+      struct frame *f = try_frame_alloc_and_lock (page, may_evict);
+      if (f != NULL)
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f;
+        }
+      if (!may_evict)
+        break;
+      timer_msleep (1000);
+    }
+  return NULL;
+}
+
+/* Locks P's frame into memory, if it has one, waiting for any
+   eviction in progress.  Upon return, P->frame does not change
+   until frame_unlock() is called. */
+void
+frame_lock (struct page *p)
+{
+  /* A frame can be asynchronously removed, but never inserted. */
+  struct frame *f = p->frame;
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL);
+        }
+    }
+}
+
+/* Releases frame F for use by another page.
+   F must be locked by the current thread. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  f->page = NULL;
+  lock_release (&f->lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted.
+   F must be locked by the current thread. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* frame_set callbacks for the real frame table. */
+
+static bool
+frame_claim (struct frame_set *set UNUSED, size_t idx)
+{
+  return frame_try_lock (&frames[idx]);
+}
+
+static void
+frame_release (struct frame_set *set UNUSED, size_t idx)
+{
+  lock_release (&frames[idx].lock);
+}
+
+static bool
+frame_accessed (struct frame_set *set UNUSED, size_t idx, bool clear)
+{
+  struct page *p = frames[idx].page;
+  return p != NULL && page_accessed (p, clear);
+}
+
+static bool
+frame_dirty (struct frame_set *set UNUSED, size_t idx)
+{
+  struct page *p = frames[idx].page;
+  return p != NULL && page_dirty (p);
+}
+
+static int64_t
+frame_now (struct frame_set *set UNUSED)
+{
+  return timer_ticks ();
+}
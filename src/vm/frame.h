@@ -0,0 +1,23 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct page;
+
+/* A physical frame in the user pool. */
+struct frame
+  {
+    struct lock lock;           /* Held while in use or being evicted. */
+    void *base;                 /* Kernel virtual base address. */
+    struct page *page;          /* Page occupying the frame, if any. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc_and_lock (struct page *, bool may_evict);
+void frame_lock (struct page *);
+void frame_unlock (struct frame *);
+void frame_free (struct frame *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,596 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/frame.h"
+#include "vm/policy.h"
+#include "vm/swap.h"
+#include "filesys/file.h"
+#include "userprog/pagedir.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Maximum number of pages a user stack may grow to.
+   Controlled by kernel command-line option "-sl". */
+size_t stack_page_limit = STACK_PAGES_DEFAULT;
+
+/* Number of neighbouring pages to map on each page fault.
+   Controlled by kernel command-line option "-fa". */
+size_t fault_around_pages = FAULT_AROUND_DEFAULT;
+
+/* Print per-process page fault counters on exit?
+   Controlled by kernel command-line option "-vmstats". */
+bool page_print_process_stats;
+
+/* System-wide totals of the per-process counters. */
+static struct page_stats total_stats;
+
+/* Number of pages evicted from memory. */
+static unsigned eviction_cnt;
+
+/* A page of zeros, mapped read-only in place of every all-zero
+   page until the process first writes to it. */
+static void *zero_page;
+
+/* The PUSHA instruction pushes 32 bytes at once and is the
+   farthest below the stack pointer that a legitimate access
+   can fault. */
+#define PUSHA_BYTES 32
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+
+/* Initializes the paging module. */
+void
+page_init (void)
+{
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Creates the current process's supplemental page table.
+   Returns true if successful, false on memory allocation
+   failure. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  memset (&t->page_stats, 0, sizeof t->page_stats);
+  return hash_init (&t->pages, page_hash, page_less, NULL);
+}
+
+/* Frees every page in the current process's supplemental page
+   table, along with their frames and swap slots. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+  struct page_stats *s = &t->page_stats;
+
+  /* Kernel threads and processes that failed to load before
+     creating a table have no buckets. */
+  if (t->pages.buckets == NULL)
+    return;
+  hash_destroy (&t->pages, page_destroy);
+  t->pages.buckets = NULL;
+
+  total_stats.major_faults += s->major_faults;
+  total_stats.minor_faults += s->minor_faults;
+  total_stats.around_mapped += s->around_mapped;
+  total_stats.around_hits += s->around_hits;
+  total_stats.cow_promotions += s->cow_promotions;
+  if (page_print_process_stats)
+    printf ("%s: %u major faults, %u minor faults, "
+            "%u fault-around pages (%u used), %u COW promotions\n",
+            t->name, s->major_faults, s->minor_faults,
+            s->around_mapped, s->around_hits, s->cow_promotions);
+}
+
+/* Returns the page containing user virtual address UADDR in the
+   current process, or a null pointer if there is none. */
+static struct page *
+page_lookup (const void *uaddr)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (uaddr);
+  e = hash_find (&t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Adds a not-yet-present page at UPAGE to the current process.
+   Returns the new page, or a null pointer if UPAGE is already
+   in use or memory is exhausted. */
+static struct page *
+page_add (void *upage, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  p = calloc (1, sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->thread = t;
+  p->writable = writable;
+  p->swap_slot = SWAP_NONE;
+  if (hash_insert (&t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds a page at UPAGE whose contents are DATA_OFS zero bytes,
+   then READ_BYTES bytes of FILE starting at FILE_OFS, then
+   zeros.  The page is read in on first access.
+   Returns true if successful, false if UPAGE is already in use
+   or memory is exhausted. */
+bool
+page_add_file (void *upage, struct file *file, off_t file_ofs,
+               size_t data_ofs, size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (data_ofs + read_bytes <= PGSIZE);
+
+  p = page_add (upage, writable);
+  if (p == NULL)
+    return false;
+  if (read_bytes > 0)
+    {
+      p->file = file;
+      p->file_ofs = file_ofs;
+      p->data_ofs = data_ofs;
+      p->read_bytes = read_bytes;
+    }
+  return true;
+}
+
+/* Adds an all-zero page at UPAGE, which is filled in on first
+   access.
+   Returns true if successful, false if UPAGE is already in use
+   or memory is exhausted. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  return page_add (upage, writable) != NULL;
+}
+
+/* Returns true if bringing in P needs disk I/O. */
+static bool
+page_needs_io (const struct page *p)
+{
+  return p->swap_slot != SWAP_NONE || (p->file != NULL && !p->private);
+}
+
+/* Reads P's contents into KPAGE, from swap if it was swapped out
+   or else from its file.
+   Returns true if successful, false if the file read comes up
+   short. */
+static bool
+page_read_in (struct page *p, uint8_t *kpage)
+{
+  if (p->swap_slot != SWAP_NONE)
+    {
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_NONE;
+      return true;
+    }
+
+  ASSERT (!p->private);
+  memset (kpage, 0, p->data_ofs);
+  if (p->read_bytes > 0
+      && file_read_at (p->file, kpage + p->data_ofs, p->read_bytes,
+                       p->file_ofs) != p->read_bytes)
+    return false;
+  memset (kpage + p->data_ofs + p->read_bytes, 0,
+          PGSIZE - p->data_ofs - p->read_bytes);
+  return true;
+}
+
+/* Brings in P, which is not present, and maps it.  An all-zero
+   page that is not about to be written (WRITE is false) shares
+   the read-only zero page; anything else gets a frame, evicting
+   another page for it if MAY_EVICT is true.  On success P's
+   frame, if any, is left locked.
+   Returns true if successful, false if memory is exhausted or
+   the file read comes up short. */
+static bool
+page_load (struct page *p, bool write, bool may_evict)
+{
+  struct thread *t = thread_current ();
+  struct frame *f;
+
+  ASSERT (p->frame == NULL && !p->zero_mapped);
+
+  if (p->file == NULL && !p->private && !write)
+    {
+      if (!pagedir_set_page (t->pagedir, p->upage, zero_page, false))
+        return false;
+      p->zero_mapped = true;
+      return true;
+    }
+
+  f = frame_alloc_and_lock (p, may_evict);
+  if (f == NULL)
+    return false;
+  if (!page_read_in (p, f->base)
+      || !pagedir_set_page (t->pagedir, p->upage, f->base, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  return true;
+}
+
+/* Gives P, which currently shares the zero page, a private
+   zeroed frame that it may write.  On success P's frame is left
+   locked.
+   Returns true if successful, false if memory is exhausted. */
+static bool
+page_break_cow (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct frame *f;
+
+  ASSERT (p->zero_mapped);
+
+  f = frame_alloc_and_lock (p, true);
+  if (f == NULL)
+    return false;
+  memset (f->base, 0, PGSIZE);
+  pagedir_clear_page (t->pagedir, p->upage);
+  if (!pagedir_set_page (t->pagedir, p->upage, f->base, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->zero_mapped = false;
+  p->frame = f;
+  t->page_stats.cow_promotions++;
+  return true;
+}
+
+/* Makes P present, and writable if WRITE is true, and locks its
+   frame so that it cannot be evicted.  A page that shares the
+   zero page and is only read has no frame to lock.
+   Returns true if successful, false if memory is exhausted or
+   the page cannot be read. */
+static bool
+page_bring_in (struct page *p, bool write)
+{
+  struct page_stats *s = &thread_current ()->page_stats;
+  bool major;
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    return true;
+  if (p->zero_mapped)
+    {
+      if (!write)
+        return true;
+      s->minor_faults++;
+      return page_break_cow (p);
+    }
+
+  major = page_needs_io (p);
+  if (!page_load (p, write, true))
+    return false;
+  if (major)
+    s->major_faults++;
+  else
+    s->minor_faults++;
+  return true;
+}
+
+/* Unlocks P's frame, if it has one. */
+static void
+page_unlock (struct page *p)
+{
+  if (p->frame != NULL)
+    frame_unlock (p->frame);
+}
+
+/* Returns true if neighbour Q may be mapped along with faulting
+   page P: it must not be present, must come from the same
+   mapping, that is, the same file or both zero-filled, and must
+   be loadable without swap I/O. */
+static bool
+can_fault_around (const struct page *p, const struct page *q)
+{
+  return (q != NULL && q->frame == NULL && !q->zero_mapped
+          && !q->private && q->swap_slot == SWAP_NONE
+          && q->file == p->file);
+}
+
+/* Maps up to fault_around_pages pages next to faulting page P
+   that belong to the same mapping, first above P and then below
+   it, so that a sequential scan takes one fault per window
+   instead of one per page.  Only free frames are used: mapping
+   ahead is never worth evicting a page for. */
+static void
+fault_around (struct page *p)
+{
+  struct page_stats *s = &thread_current ()->page_stats;
+  size_t budget = fault_around_pages;
+  int dir;
+
+  for (dir = 1; dir >= -1 && budget > 0; dir -= 2)
+    {
+      uint8_t *upage = (uint8_t *) p->upage + dir * PGSIZE;
+
+      while (budget > 0 && is_user_vaddr (upage))
+        {
+          struct page *q = page_lookup (upage);
+          if (!can_fault_around (p, q) || !page_load (q, false, false))
+            break;
+          page_unlock (q);
+          q->prefetched = true;
+          s->around_mapped++;
+          budget--;
+          upage += dir * PGSIZE;
+        }
+    }
+}
+
+/* Returns true if FAULT_ADDR, which faulted while the user stack
+   pointer was ESP, is a plausible stack access: within the stack
+   limit below PHYS_BASE and no more than PUSHA_BYTES below
+   ESP. */
+static bool
+is_stack_access (const uint8_t *fault_addr, const uint8_t *esp)
+{
+  const uint8_t *stack_bottom = (uint8_t *) PHYS_BASE
+                                - stack_page_limit * PGSIZE;
+
+  return (is_user_vaddr (fault_addr)
+          && fault_addr >= stack_bottom
+          && fault_addr + PUSHA_BYTES >= esp);
+}
+
+/* Returns the page of the current process that an access to
+   UADDR, for writing if WRITE is true, with user stack pointer
+   ESP, should use.  Accesses that look like stack growth add a
+   new stack page.
+   Returns a null pointer if the access is invalid. */
+static struct page *
+page_for_access (const void *uaddr, bool write, void *esp)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  /* Kernel threads have no user address space at all. */
+  if (!is_user_vaddr (uaddr) || t->pagedir == NULL)
+    return NULL;
+
+  p = page_lookup (uaddr);
+  if (p == NULL && is_stack_access (uaddr, esp))
+    p = page_add (pg_round_down (uaddr), true);
+  if (p == NULL || (write && !p->writable))
+    return NULL;
+  return p;
+}
+
+/* Makes the page containing FAULT_ADDR accessible for reading,
+   or for writing if WRITE is true, after an access to it faulted
+   while the user stack pointer was ESP.  Pages not yet part of
+   the process are added as stack pages if the access looks like
+   stack growth.  A write to a page sharing the zero page gives
+   it a private copy.
+   Returns true if the access can be retried, false if it was
+   invalid or memory is exhausted. */
+bool
+page_fault_in (void *fault_addr, bool write, void *esp)
+{
+  struct page *p = page_for_access (fault_addr, write, esp);
+  bool was_absent;
+
+  if (p == NULL)
+    return false;
+
+  was_absent = p->frame == NULL && !p->zero_mapped;
+  if (!page_bring_in (p, write))
+    return false;
+  if (was_absent)
+    fault_around (p);
+  page_unlock (p);
+  return true;
+}
+
+/* Makes every page in the SIZE bytes starting at UADDR present,
+   and writable if WRITE is true, and pins them in memory until
+   page_unpin_range() is called.  System calls use this before
+   handing a user buffer to the file system, which must not page
+   fault while it holds a disk's channel lock.
+   Returns true if successful, false if some page is invalid, in
+   which case nothing is left pinned. */
+bool
+page_pin_range (const void *uaddr, size_t size, bool write)
+{
+  struct thread *t = thread_current ();
+  const uint8_t *start = pg_round_down (uaddr);
+  const uint8_t *upage;
+
+  if (size == 0)
+    return true;
+  for (upage = start; upage <= (const uint8_t *) uaddr + size - 1;
+       upage += PGSIZE)
+    {
+      struct page *p = page_for_access (upage, write, t->user_esp);
+      if (p == NULL || !page_bring_in (p, write))
+        {
+          page_unpin_range (start, upage - start);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Unpins the pages in the SIZE bytes starting at UADDR, which
+   must have been pinned with page_pin_range(). */
+void
+page_unpin_range (const void *uaddr, size_t size)
+{
+  const uint8_t *upage;
+
+  if (size == 0)
+    return;
+  for (upage = pg_round_down (uaddr);
+       upage <= (const uint8_t *) uaddr + size - 1; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (upage);
+      if (p != NULL && p->frame != NULL
+          && lock_held_by_current_thread (&p->frame->lock))
+        frame_unlock (p->frame);
+    }
+}
+
+/* Returns the kernel address of a frame holding UPAGE in the
+   current process, bringing it in first if necessary, so that
+   the kernel may write to it directly.  The frame stays locked
+   until page_unlock_frame() is called.
+   Returns a null pointer if UPAGE is not part of the process or
+   cannot be brought in. */
+void *
+page_lock_frame (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  if (p == NULL || !page_bring_in (p, true))
+    return NULL;
+
+  /* Writes through the kernel alias leave the user PTE's dirty
+     bit clear, so the page can no longer be re-read from its
+     backing file. */
+  p->private = true;
+  return p->frame->base;
+}
+
+/* Unlocks the frame of UPAGE, locked with page_lock_frame(). */
+void
+page_unlock_frame (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL && p->frame != NULL);
+  frame_unlock (p->frame);
+}
+
+/* Evicts P from its frame, which the caller must have locked,
+   writing it to swap unless it can be brought back from its file
+   or the zero page.
+   Returns true if successful, false if swap is full. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Unmap first, so that the owner faults, and waits for us,
+     rather than changing the page while it is being written. */
+  if (p->prefetched && pagedir_is_accessed (pd, p->upage))
+    p->thread->page_stats.around_hits++;
+  p->prefetched = false;
+  pagedir_clear_page (pd, p->upage);
+
+  if (pagedir_is_dirty (pd, p->upage))
+    p->private = true;
+  if (p->private && !swap_out (p->frame->base, &p->swap_slot))
+    {
+      pagedir_set_page (pd, p->upage, p->frame->base, p->writable);
+      return false;
+    }
+
+  p->frame = NULL;
+  eviction_cnt++;
+  return true;
+}
+
+/* Returns true if P, which must be present, has been accessed
+   since the bit was last cleared, and clears it if CLEAR is
+   true. */
+bool
+page_accessed (struct page *p, bool clear)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool accessed = pagedir_is_accessed (pd, p->upage);
+
+  if (accessed && clear)
+    pagedir_set_accessed (pd, p->upage, false);
+  return accessed;
+}
+
+/* Returns true if P, which must be present, would have to be
+   written to swap to be evicted. */
+bool
+page_dirty (struct page *p)
+{
+  return p->private || pagedir_is_dirty (p->thread->pagedir, p->upage);
+}
+
+/* Prints system-wide paging statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %u major faults, %u minor faults, "
+          "%u fault-around pages (%u used), %u COW promotions, "
+          "%u evictions by %s\n",
+          total_stats.major_faults, total_stats.minor_faults,
+          total_stats.around_mapped, total_stats.around_hits,
+          total_stats.cow_promotions, eviction_cnt,
+          replacement_policy->name);
+  swap_print_stats ();
+}
+
+/* Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_int ((uintptr_t) p->upage >> PGBITS);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
+
+/* Unmaps and frees the page that E refers to, along with its
+   frame and swap slot. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct thread *t = thread_current ();
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      if (p->prefetched && pagedir_is_accessed (t->pagedir, p->upage))
+        t->page_stats.around_hits++;
+      pagedir_clear_page (t->pagedir, p->upage);
+      frame_free (p->frame);
+    }
+  else if (p->zero_mapped)
+    pagedir_clear_page (t->pagedir, p->upage);
+  if (p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+  free (p);
+}
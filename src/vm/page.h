@@ -0,0 +1,83 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/disk.h"
+#include "filesys/off_t.h"
+
+/* Default maximum size of a user stack, in pages (8 MB). */
+#define STACK_PAGES_DEFAULT 2048
+
+/* Default number of neighbouring pages mapped by fault-around. */
+#define FAULT_AROUND_DEFAULT 4
+
+/* A page of user virtual memory, as recorded in its process's
+   supplemental page table.  The page table proper (pagedir) only
+   knows about pages that are present; this records where every
+   other page's contents come from. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in thread's `pages'. */
+    void *upage;                        /* User virtual address. */
+    struct thread *thread;              /* Owning process. */
+    bool writable;                      /* Read/write or read-only? */
+
+    /* Changed only by the owning process, or by another process
+       that holds FRAME's lock while evicting the page. */
+    struct frame *frame;                /* Frame holding page, if any. */
+    bool zero_mapped;                   /* Mapped to the zero page? */
+    bool prefetched;                    /* Mapped by fault-around? */
+    bool private;                       /* Contents only in memory/swap? */
+    disk_sector_t swap_slot;            /* Swap slot, or SWAP_NONE. */
+
+    /* Contents, unless private: DATA_OFS zero bytes, then
+       READ_BYTES bytes from FILE at FILE_OFS, then zeros up to
+       PGSIZE.  FILE is NULL for an all-zero page. */
+    struct file *file;                  /* Backing file, or NULL. */
+    off_t file_ofs;                     /* Offset in FILE. */
+    uint16_t data_ofs;                  /* Offset of file data in page. */
+    uint16_t read_bytes;                /* Bytes to read from FILE. */
+  };
+
+/* Per-process page fault counters. */
+struct page_stats
+  {
+    unsigned major_faults;              /* Faults that read the disk. */
+    unsigned minor_faults;              /* Faults satisfied without I/O. */
+    unsigned around_mapped;             /* Pages mapped by fault-around. */
+    unsigned around_hits;               /* ...that were later accessed. */
+    unsigned cow_promotions;            /* Zero pages given own frame. */
+  };
+
+/* Maximum number of pages a user stack may grow to. */
+extern size_t stack_page_limit;
+
+/* Number of neighbouring pages to map on each page fault. */
+extern size_t fault_around_pages;
+
+/* Print per-process page fault counters on exit? */
+extern bool page_print_process_stats;
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_add_file (void *upage, struct file *, off_t file_ofs,
+                    size_t data_ofs, size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+
+bool page_fault_in (void *fault_addr, bool write, void *esp);
+bool page_pin_range (const void *uaddr, size_t size, bool write);
+void page_unpin_range (const void *uaddr, size_t size);
+void *page_lock_frame (void *upage);
+void page_unlock_frame (void *upage);
+
+bool page_out (struct page *);
+bool page_accessed (struct page *, bool clear);
+bool page_dirty (struct page *);
+
+void page_print_stats (void);
+
+#endif /* vm/page.h */
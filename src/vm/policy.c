@@ -0,0 +1,193 @@
+#include "vm/policy.h"
+#include <debug.h>
+#include <string.h>
+
+/* Page replacement policies.
+
+   Each policy picks a victim from a `struct frame_set', which
+   hides whether the frames are real (vm/frame.c) or simulated
+   (vm/bench.c).  A policy must claim a frame before looking at
+   its accessed and dirty bits and must release every claimed
+   frame other than the one it returns. */
+
+/* Returns the frame under SET's clock hand and advances the
+   hand. */
+static size_t
+advance_hand (struct frame_set *set)
+{
+  size_t idx = set->hand;
+  set->hand = (set->hand + 1) % set->cnt;
+  return idx;
+}
+
+/* Clock, aka second chance: sweeps the frames in order, clearing
+   accessed bits, and evicts the first frame whose bit is already
+   clear.  Two full sweeps are enough to clear every bit. */
+static size_t
+clock_choose (struct frame_set *set)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * set->cnt; i++)
+    {
+      size_t idx = advance_hand (set);
+      if (!set->claim (set, idx))
+        continue;
+      if (!set->accessed (set, idx, true))
+        return idx;
+      set->release (set, idx);
+    }
+  return POLICY_NONE;
+}
+
+/* Enhanced second chance: prefers frames that are neither
+   accessed nor dirty, then ones that are dirty but not accessed,
+   so that clean pages, which need no swap write, go first.
+   The first sweep of each pair leaves accessed bits alone; the
+   second clears them so that the next pair can make progress. */
+static size_t
+esc_choose (struct frame_set *set)
+{
+  int round;
+
+  for (round = 0; round < 4; round++)
+    {
+      bool want_dirty = round % 2 == 1;
+      size_t i;
+
+      for (i = 0; i < set->cnt; i++)
+        {
+          size_t idx = advance_hand (set);
+          if (!set->claim (set, idx))
+            continue;
+          if (!set->accessed (set, idx, want_dirty)
+              && set->dirty (set, idx) == want_dirty)
+            return idx;
+          set->release (set, idx);
+        }
+    }
+  return POLICY_NONE;
+}
+
+/* LRU approximation by aging: each frame's age is a shift
+   register into whose top bit the accessed bit is shifted on
+   every eviction.  The frame with the smallest age, the one
+   used least recently, is evicted. */
+static size_t
+aging_choose (struct frame_set *set)
+{
+  size_t best = POLICY_NONE;
+  size_t idx;
+
+  for (idx = 0; idx < set->cnt; idx++)
+    {
+      struct policy_frame *s = &set->state[idx];
+      if (!set->claim (set, idx))
+        continue;
+      s->age = (s->age >> 1)
+               | (set->accessed (set, idx, true) ? 1u << 31 : 0);
+      if (best == POLICY_NONE || s->age < set->state[best].age)
+        {
+          if (best != POLICY_NONE)
+            set->release (set, best);
+          best = idx;
+        }
+      else
+        set->release (set, idx);
+    }
+  return best;
+}
+
+/* WSClock: a clock sweep that records each frame's last use in
+   virtual time and evicts the first clean frame that has fallen
+   out of the working set, i.e. not been used for TAU.  Writing
+   back dirty frames in the background is out of reach here, so
+   if no such clean frame exists the least recently used frame
+   seen is evicted instead. */
+static size_t
+wsclock_choose (struct frame_set *set)
+{
+  int64_t now = set->now (set);
+  size_t best = POLICY_NONE;
+  size_t i;
+
+  for (i = 0; i < 2 * set->cnt; i++)
+    {
+      size_t idx = advance_hand (set);
+      struct policy_frame *s = &set->state[idx];
+
+      if (i == set->cnt && best != POLICY_NONE)
+        break;
+      if (!set->claim (set, idx))
+        continue;
+      if (set->accessed (set, idx, true))
+        {
+          s->last_use = now;
+          set->release (set, idx);
+        }
+      else if (now - s->last_use > set->tau && !set->dirty (set, idx))
+        {
+          if (best != POLICY_NONE)
+            set->release (set, best);
+          return idx;
+        }
+      else if (best == POLICY_NONE
+               || s->last_use < set->state[best].last_use)
+        {
+          if (best != POLICY_NONE)
+            set->release (set, best);
+          best = idx;
+        }
+      else
+        set->release (set, idx);
+    }
+  return best;
+}
+
+static const struct replacement_policy clock_policy = {"clock", clock_choose};
+static const struct replacement_policy esc_policy = {"esc", esc_choose};
+static const struct replacement_policy aging_policy = {"aging", aging_choose};
+static const struct replacement_policy wsclock_policy =
+  {"wsclock", wsclock_choose};
+
+/* All policies, terminated by a null pointer. */
+const struct replacement_policy *const replacement_policies[] =
+  {
+    &clock_policy,
+    &esc_policy,
+    &aging_policy,
+    &wsclock_policy,
+    NULL,
+  };
+
+/* The policy used by the frame table.
+   Controlled by kernel command-line option "-rp". */
+const struct replacement_policy *replacement_policy = &clock_policy;
+
+/* Makes the policy called NAME the frame table's policy.
+   Returns true if successful, false if there is no such
+   policy. */
+bool
+policy_select (const char *name)
+{
+  const struct replacement_policy *const *p;
+
+  for (p = replacement_policies; *p != NULL; p++)
+    if (!strcmp ((*p)->name, name))
+      {
+        replacement_policy = *p;
+        return true;
+      }
+  return false;
+}
+
+/* Resets the policy state of frame IDX in SET, which has just
+   been filled with a page, as if the page had just been used. */
+void
+policy_frame_loaded (struct frame_set *set, size_t idx)
+{
+  ASSERT (idx < set->cnt);
+
+  set->state[idx].age = 1u << 31;
+  set->state[idx].last_use = set->now (set);
+}
@@ -0,0 +1,67 @@
+#ifndef VM_POLICY_H
+#define VM_POLICY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by a policy that finds no frame it may evict. */
+#define POLICY_NONE SIZE_MAX
+
+/* Replacement state kept for each frame. */
+struct policy_frame
+  {
+    uint32_t age;               /* Aging: shift register of A bits. */
+    int64_t last_use;           /* WSClock: virtual time of last use. */
+  };
+
+/* A set of frames for a replacement policy to choose a victim
+   from.  The frame table and the replay benchmark's simulated
+   memory each provide one. */
+struct frame_set
+  {
+    size_t cnt;                         /* Number of frames. */
+    size_t hand;                        /* Clock hand. */
+    int64_t tau;                        /* WSClock working set window. */
+    struct policy_frame *state;         /* CNT entries of policy state. */
+
+    /* Claims frame IDX as a possible victim.  Returns false if the
+       frame may not be evicted right now, e.g. because it is
+       pinned. */
+    bool (*claim) (struct frame_set *, size_t idx);
+
+    /* Gives up a claim on frame IDX that was not chosen. */
+    void (*release) (struct frame_set *, size_t idx);
+
+    /* Returns the accessed bit of claimed frame IDX, clearing it
+       if CLEAR is true. */
+    bool (*accessed) (struct frame_set *, size_t idx, bool clear);
+
+    /* Returns true if claimed frame IDX has been modified since it
+       was last read in. */
+    bool (*dirty) (struct frame_set *, size_t idx);
+
+    /* Returns the current virtual time. */
+    int64_t (*now) (struct frame_set *);
+  };
+
+/* A page replacement policy. */
+struct replacement_policy
+  {
+    const char *name;                   /* Name for "-rp" option. */
+
+    /* Returns a claimed frame to evict from SET, or POLICY_NONE
+       if none can be claimed. */
+    size_t (*choose) (struct frame_set *set);
+  };
+
+/* All policies, terminated by a null pointer. */
+extern const struct replacement_policy *const replacement_policies[];
+
+/* The policy used by the frame table. */
+extern const struct replacement_policy *replacement_policy;
+
+bool policy_select (const char *name);
+void policy_frame_loaded (struct frame_set *, size_t idx);
+
+#endif /* vm/policy.h */
@@ -0,0 +1,120 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "vm/zcache.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The swap disk, hd1:1. */
+static struct disk *swap_disk;
+
+/* Used swap slots, one bit per page-sized slot. */
+static struct bitmap *swap_bitmap;
+
+/* Protects swap_bitmap. */
+static struct lock swap_lock;
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Number of pages written to and read from swap. */
+static long long swap_write_cnt;
+static long long swap_read_cnt;
+
+/* Initializes the swap disk and the compressed cache in front
+   of it.  Without a swap disk, pages that would need to be
+   swapped out stay in memory. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  swap_disk = disk_get (1, 1);
+  if (swap_disk == NULL)
+    {
+      printf ("swap: hd1:1 (hdd) not present, swapping disabled\n");
+      return;
+    }
+  swap_bitmap = bitmap_create (disk_size (swap_disk) / PAGE_SECTORS);
+  if (swap_bitmap == NULL)
+    PANIC ("swap bitmap creation failed--swap disk is too large");
+  zcache_init ();
+}
+
+/* Writes the page at KPAGE to swap slot SLOT on disk. */
+void
+swap_write_slot (disk_sector_t slot, const void *kpage)
+{
+  disk_write_multiple (swap_disk, slot * PAGE_SECTORS, PAGE_SECTORS, kpage);
+  lock_acquire (&swap_lock);
+  swap_write_cnt++;
+  lock_release (&swap_lock);
+}
+
+/* Writes the page at KPAGE to a free swap slot and stores the
+   slot into *SLOTP.
+   Returns true if successful, false if swap is full or
+   missing. */
+bool
+swap_out (const void *kpage, disk_sector_t *slotp)
+{
+  size_t slot;
+
+  if (swap_bitmap == NULL)
+    return false;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return false;
+
+  /* The slot is reserved even for a page kept in the compressed
+     cache, so that the cache can write it back at any time. */
+  if (!zcache_store (slot, kpage))
+    swap_write_slot (slot, kpage);
+  *slotp = slot;
+  return true;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees the
+   slot. */
+void
+swap_in (disk_sector_t slot, void *kpage)
+{
+  ASSERT (slot != SWAP_NONE);
+
+  if (!zcache_load (slot, kpage))
+    {
+      disk_read_multiple (swap_disk, slot * PAGE_SECTORS, PAGE_SECTORS, kpage);
+      lock_acquire (&swap_lock);
+      swap_read_cnt++;
+      lock_release (&swap_lock);
+    }
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_bitmap, slot));
+  bitmap_reset (swap_bitmap, slot);
+  lock_release (&swap_lock);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (disk_sector_t slot)
+{
+  ASSERT (slot != SWAP_NONE);
+
+  zcache_discard (slot);
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_bitmap, slot));
+  bitmap_reset (swap_bitmap, slot);
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages written, %lld pages read\n",
+          swap_write_cnt, swap_read_cnt);
+  zcache_print_stats ();
+}
@@ -0,0 +1,17 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Swap slot value meaning "not in swap". */
+#define SWAP_NONE ((disk_sector_t) -1)
+
+void swap_init (void);
+bool swap_out (const void *kpage, disk_sector_t *slotp);
+void swap_in (disk_sector_t slot, void *kpage);
+void swap_free (disk_sector_t slot);
+void swap_write_slot (disk_sector_t slot, const void *kpage);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
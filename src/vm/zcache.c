@@ -0,0 +1,255 @@
+#include "vm/zcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <lz.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/swap.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap cache.
+
+   Pages on their way to swap are compressed and kept in a pool
+   of kernel memory instead, as long as they compress to no more
+   than ZCACHE_MAX_SIZE bytes.  Each cached page keeps the swap
+   slot that swap_out() reserved for it, so when the pool is full
+   the oldest pages are simply written back to their slots to make
+   room.  swap_in() then finds a page either here or on disk. */
+
+/* Size of the pool, in pages.
+   Controlled by kernel command-line option "-zc". */
+size_t zcache_pages;
+
+/* Pages that compress worse than this go straight to disk. */
+#define ZCACHE_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* A compressed page. */
+struct zentry
+  {
+    struct hash_elem hash_elem;         /* Element in `entries'. */
+    struct list_elem list_elem;         /* Element in `age_list'. */
+    disk_sector_t slot;                 /* Reserved swap slot. */
+    size_t size;                        /* Bytes of compressed data. */
+    uint8_t data[];                     /* Compressed data. */
+  };
+
+/* Cached pages, by swap slot, and the same pages oldest first. */
+static struct hash entries;
+static struct list age_list;
+
+/* Protects all of the above and the buffers below. */
+static struct lock zcache_lock;
+
+/* Is the cache enabled? */
+static bool enabled;
+
+/* Bytes of pool in use, including entry headers, and limit. */
+static size_t pool_bytes;
+static size_t pool_limit;
+
+/* Scratch space for compression and write-back. */
+static uint8_t compress_buf[ZCACHE_MAX_SIZE];
+static uint8_t page_buf[PGSIZE];
+static uint16_t lz_table[LZ_TABLE_SIZE];
+
+/* Statistics. */
+static unsigned store_cnt;              /* Pages compressed. */
+static unsigned reject_cnt;             /* Pages that did not compress. */
+static unsigned writeback_cnt;          /* Pages written back to disk. */
+static unsigned hit_cnt;                /* Pages read back from cache. */
+static unsigned miss_cnt;               /* Pages read back from disk. */
+static long long compressed_bytes;      /* Compressed size of stores. */
+
+static hash_hash_func zentry_hash;
+static hash_less_func zentry_less;
+
+/* Initializes the compressed swap cache, if zcache_pages is
+   nonzero. */
+void
+zcache_init (void)
+{
+  if (zcache_pages == 0)
+    return;
+
+  lock_init (&zcache_lock);
+  list_init (&age_list);
+  if (!hash_init (&entries, zentry_hash, zentry_less, NULL))
+    PANIC ("out of memory allocating compressed swap cache");
+  pool_limit = zcache_pages * PGSIZE;
+  enabled = true;
+  printf ("swap: %zu kB compressed cache\n", pool_limit / 1024);
+}
+
+/* Returns the cached page in SLOT, or a null pointer if there
+   is none.  zcache_lock must be held. */
+static struct zentry *
+zentry_lookup (disk_sector_t slot)
+{
+  struct zentry e;
+  struct hash_elem *h;
+
+  e.slot = slot;
+  h = hash_find (&entries, &e.hash_elem);
+  return h != NULL ? hash_entry (h, struct zentry, hash_elem) : NULL;
+}
+
+/* Removes E from the cache and frees it.  zcache_lock must be
+   held. */
+static void
+zentry_remove (struct zentry *e)
+{
+  hash_delete (&entries, &e->hash_elem);
+  list_remove (&e->list_elem);
+  pool_bytes -= sizeof *e + e->size;
+  free (e);
+}
+
+/* Decompresses E into KPAGE.  zcache_lock must be held. */
+static void
+zentry_decompress (struct zentry *e, void *kpage)
+{
+  if (!lz_decompress (e->data, e->size, kpage, PGSIZE))
+    PANIC ("compressed swap cache: slot %"PRDSNu" is corrupt", e->slot);
+}
+
+/* Writes the oldest cached page back to its swap slot and drops
+   it from the cache.  zcache_lock must be held. */
+static void
+writeback_oldest (void)
+{
+  struct zentry *e = list_entry (list_front (&age_list),
+                                 struct zentry, list_elem);
+
+  zentry_decompress (e, page_buf);
+  swap_write_slot (e->slot, page_buf);
+  zentry_remove (e);
+  writeback_cnt++;
+}
+
+/* Tries to keep the page at KPAGE, which belongs in swap slot
+   SLOT, in the compressed cache, writing older pages back to
+   disk if the pool is full.
+   Returns true if successful, false if the cache is disabled or
+   the page does not compress well, in which case the caller must
+   write it to SLOT itself. */
+bool
+zcache_store (disk_sector_t slot, const void *kpage)
+{
+  struct zentry *e;
+  size_t size;
+
+  if (!enabled)
+    return false;
+
+  lock_acquire (&zcache_lock);
+  size = lz_compress (kpage, PGSIZE, compress_buf, sizeof compress_buf,
+                      lz_table);
+  if (size == 0 || sizeof *e + size > pool_limit)
+    {
+      reject_cnt++;
+      lock_release (&zcache_lock);
+      return false;
+    }
+
+  while (pool_bytes + sizeof *e + size > pool_limit)
+    writeback_oldest ();
+
+  e = malloc (sizeof *e + size);
+  if (e == NULL)
+    {
+      reject_cnt++;
+      lock_release (&zcache_lock);
+      return false;
+    }
+  e->slot = slot;
+  e->size = size;
+  memcpy (e->data, compress_buf, size);
+  hash_insert (&entries, &e->hash_elem);
+  list_push_back (&age_list, &e->list_elem);
+  pool_bytes += sizeof *e + size;
+  store_cnt++;
+  compressed_bytes += size;
+  lock_release (&zcache_lock);
+  return true;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE, if it is in the
+   cache, and drops it from the cache.
+   Returns true if successful, false if the caller must read it
+   from disk. */
+bool
+zcache_load (disk_sector_t slot, void *kpage)
+{
+  struct zentry *e;
+
+  if (!enabled)
+    return false;
+
+  lock_acquire (&zcache_lock);
+  e = zentry_lookup (slot);
+  if (e != NULL)
+    {
+      zentry_decompress (e, kpage);
+      zentry_remove (e);
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&zcache_lock);
+  return e != NULL;
+}
+
+/* Drops the page in swap slot SLOT from the cache, if it is
+   there, because the slot is being freed. */
+void
+zcache_discard (disk_sector_t slot)
+{
+  struct zentry *e;
+
+  if (!enabled)
+    return;
+
+  lock_acquire (&zcache_lock);
+  e = zentry_lookup (slot);
+  if (e != NULL)
+    zentry_remove (e);
+  lock_release (&zcache_lock);
+}
+
+/* Prints compressed swap cache statistics. */
+void
+zcache_print_stats (void)
+{
+  long long stored_bytes = (long long) store_cnt * PGSIZE;
+  unsigned lookups = hit_cnt + miss_cnt;
+
+  if (!enabled)
+    return;
+  printf ("Zcache: %u pages compressed to %lld%% of size, "
+          "%u incompressible, %u written back\n",
+          store_cnt,
+          stored_bytes > 0 ? compressed_bytes * 100 / stored_bytes : 0,
+          reject_cnt, writeback_cnt);
+  printf ("Zcache: %u hits, %u misses (%u%% hit rate)\n",
+          hit_cnt, miss_cnt, lookups > 0 ? hit_cnt * 100 / lookups : 0);
+}
+
+/* Returns a hash value for the entry that E refers to. */
+static unsigned
+zentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct zentry, hash_elem)->slot);
+}
+
+/* Returns true if entry A precedes entry B. */
+static bool
+zentry_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  return (hash_entry (a, struct zentry, hash_elem)->slot
+          < hash_entry (b, struct zentry, hash_elem)->slot);
+}
@@ -0,0 +1,18 @@
+#ifndef VM_ZCACHE_H
+#define VM_ZCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Size of the compressed swap cache, in pages, or 0 to disable
+   it. */
+extern size_t zcache_pages;
+
+void zcache_init (void);
+bool zcache_store (disk_sector_t slot, const void *kpage);
+bool zcache_load (disk_sector_t slot, void *kpage);
+void zcache_discard (disk_sector_t slot);
+void zcache_print_stats (void);
+
+#endif /* vm/zcache.h */